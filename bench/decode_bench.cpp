@@ -0,0 +1,105 @@
+// Compares the image decoding backends on real inputs, typically ZoeDepth's 1080p and 4K
+// color images and 16-bit depth maps. Built from the files in src/ apart from main.cpp.
+//
+// Usage: decode_bench [--runs N] [--pair IMAGE DEPTH] FILE...
+//
+// 16-bit PNGs are decoded as depth maps and everything else as color images, once per
+// supported backend. --pair times loading an image and depth map one after the other and
+// side by side on the thread pool.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "depth_cloud.h"
+#include "image_decoder.h"
+#include "thread_pool.h"
+
+using bench_clock_t = std::chrono::steady_clock;
+
+// Median of runs, in milliseconds. Returns a negative time if any run failed.
+static double time_runs(int runs, const std::function<bool()>& fn) {
+    std::vector<double> times;
+    for (int run = 0; run < runs; run++) {
+        const auto start = bench_clock_t::now();
+        if (!fn())
+            return -1.0;
+        times.push_back(std::chrono::duration<double, std::milli>(bench_clock_t::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// PNGs with a 16-bit IHDR are depth maps.
+static bool is_16_bit_png(const std::string& path) {
+    std::array<unsigned char, 25> header = {};
+    std::ifstream ifs(path, std::ios::binary);
+    ifs.read(reinterpret_cast<char*>(header.data()), header.size());
+    return ifs && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' && header[24] == 16;
+}
+
+int main(int argc, char** argv) {
+    int runs = 5;
+    std::vector<std::string> files;
+    std::vector<std::array<std::string, 2>> pairs;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc)
+            runs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--pair" && i + 2 < argc) {
+            pairs.push_back({ argv[i + 1], argv[i + 2] });
+            i += 2;
+        }
+        else if (!arg.starts_with("--"))
+            files.push_back(arg);
+        else {
+            std::fprintf(stderr, "Usage: %s [--runs N] [--pair IMAGE DEPTH] FILE...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf("%-40s %-14s %-6s %10s %10s %10s\n", "file", "backend", "kind", "pixels", "ms", "MP/s");
+
+    for (const auto& file : files) {
+        const bool depth = is_16_bit_png(file);
+
+        for (const auto decoder : { image_decoder_t::stb, image_decoder_t::spng, image_decoder_t::turbojpeg }) {
+            // Only backends that are compiled in and would actually be picked for the format.
+            if (decoder != image_decoder_t::stb && decoder != pick_image_decoder(file))
+                continue;
+
+            size_t pixels = 0;
+            const double ms = time_runs(runs, [&]() {
+                if (depth) {
+                    auto image = decode_depth_image(decoder, file);
+                    pixels = image ? static_cast<size_t>(image->width) * image->height : 0;
+                    return image.has_value();
+                }
+                auto image = decode_rgb_image(decoder, file);
+                pixels = image ? static_cast<size_t>(image->width) * image->height : 0;
+                return image.has_value();
+            });
+
+            if (ms < 0.0)
+                std::printf("%-40s %-14s %-6s failed\n", file.c_str(), image_decoder_name(decoder), depth ? "depth" : "rgb");
+            else
+                std::printf("%-40s %-14s %-6s %10zu %10.2f %10.1f\n", file.c_str(), image_decoder_name(decoder),
+                    depth ? "depth" : "rgb", pixels, ms, pixels / ms / 1e3);
+        }
+    }
+
+    thread_pool_t pool;
+    for (const auto& [image, depth] : pairs) {
+        const double serial_ms = time_runs(runs, [&]() { return load_depth_images(image, depth).has_value(); });
+        const double concurrent_ms = time_runs(runs, [&]() { return load_depth_images(image, depth, &pool).has_value(); });
+        std::printf("pair %s + %s: %.2f ms serial, %.2f ms concurrent\n", image.c_str(), depth.c_str(), serial_ms, concurrent_ms);
+    }
+
+    return EXIT_SUCCESS;
+}
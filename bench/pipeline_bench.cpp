@@ -0,0 +1,403 @@
+// Times each stage of turning a color image and depth map into a cloud, on synthetic inputs
+// so runs on different machines and builds see the same data. Built from the files in src/
+// apart from main.cpp.
+//
+// Usage: pipeline_bench [--runs N] [--resolutions 720p,1080p,4k,8k] [--strides 1,2,...]
+//                       [--threads 1,2,...] [--format csv|json] [--dir DIR]
+//
+// Stages:
+//   decode                  loading the PNG pair written for the resolution
+//   back_project            generate_depth_cloud
+//   back_project_packed     generate_packed_depth_cloud
+//   back_project_distorted  generate_depth_cloud with lens distortion, through a per-sample ray table
+//   back_project_filtered   generate_depth_cloud with the flying pixel filter, points are those kept
+//   voxel_grid              downsample_voxel_grid over the back-projected points, points are the cells
+//   octree                  build_point_octree over the back-projected points
+//   ply                     write_ply, which is single threaded
+//   cloud_cache             write_cloud_cache, with the octree already built
+//
+// Results go to stdout, one row per stage, resolution, stride and thread count, as CSV
+// with a header or as JSON lines. points is pixels for decode and bytes is what the stage
+// reads from or writes to disk, or the vertex bytes it produces. Stages that don't depend on
+// the stride report stride 0. Times are the median of the runs.
+//
+// The PNGs are written uncompressed, as there is no encoder in the tree. Inflating them is
+// cheaper than ZoeDepth's compressed output, so decode throughput is an upper bound.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "cloud_cache.h"
+#include "depth_cloud.h"
+#include "generation_job.h"
+#include "octree.h"
+#include "ply.h"
+#include "thread_pool.h"
+#include "voxel_grid.h"
+
+using bench_clock_t = std::chrono::steady_clock;
+
+// Same default as the viewer.
+static const camera_intrinsics_t bench_intrinsics = make_pinhole_intrinsics(1400.f);
+// The viewer's default when the filter is on.
+static constexpr float bench_flying_pixel_threshold = .1f;
+// The viewer's default cell size.
+static constexpr float bench_voxel_size = .02f;
+// A typical wide angle lens, as OpenCV calibrates one.
+static const camera_intrinsics_t bench_distorted_intrinsics = [] {
+    auto intrinsics = bench_intrinsics;
+    intrinsics.k1 = -.28f;
+    intrinsics.k2 = .07f;
+    intrinsics.p1 = .0002f;
+    intrinsics.p2 = -.0001f;
+    return intrinsics;
+}();
+
+struct bench_resolution_t {
+    const char* name;
+    int width;
+    int height;
+};
+
+static constexpr std::array<bench_resolution_t, 4> bench_resolutions = {{
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 },
+    { "8k", 7680, 4320 },
+}};
+
+struct bench_row_t {
+    const char* stage;
+    const bench_resolution_t* resolution;
+    unsigned int stride;
+    unsigned int threads;
+    size_t points;
+    size_t bytes;
+    double ms;
+};
+
+// Median of runs, in milliseconds. Returns a negative time if any run failed.
+static double time_runs(int runs, const std::function<bool()>& fn) {
+    std::vector<double> times;
+    for (int run = 0; run < runs; run++) {
+        const auto start = bench_clock_t::now();
+        if (!fn())
+            return -1.0;
+        times.push_back(std::chrono::duration<double, std::milli>(bench_clock_t::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+static uint32_t update_crc(uint32_t crc, const uint8_t* data, size_t size) {
+    static const auto table = make_crc_table();
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void append_u32_be(std::vector<uint8_t>& out, uint32_t value) {
+    out.insert(out.end(), { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) });
+}
+
+static void write_png_chunk(std::ofstream& ofs, const char (&type)[5], const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> chunk;
+    append_u32_be(chunk, static_cast<uint32_t>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    append_u32_be(chunk, update_crc(0xffffffffu, chunk.data() + 4, chunk.size() - 4) ^ 0xffffffffu);
+    ofs.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+}
+
+// Writes rows of big endian samples as a PNG with stored deflate blocks. color_type is 0 for
+// grey and 2 for RGB.
+static bool write_stored_png(const std::filesystem::path& path, int width, int height, int bit_depth, int color_type, const std::vector<uint8_t>& pixels) {
+    const size_t row_size = pixels.size() / height;
+
+    // Every row starts with filter type 0.
+    std::vector<uint8_t> raw;
+    raw.reserve(pixels.size() + height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels.begin() + y * row_size, pixels.begin() + (y + 1) * row_size);
+    }
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    for (size_t first = 0; first < raw.size() || first == 0; first += 65535) {
+        const auto size = static_cast<uint16_t>(std::min<size_t>(65535, raw.size() - first));
+        const bool last = first + size >= raw.size();
+        zlib.insert(zlib.end(), { uint8_t(last), uint8_t(size), uint8_t(size >> 8), uint8_t(~size), uint8_t(~size >> 8) });
+        zlib.insert(zlib.end(), raw.begin() + first, raw.begin() + first + size);
+        if (last)
+            break;
+    }
+
+    uint32_t a = 1, b = 0;
+    for (const uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    append_u32_be(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    append_u32_be(header, static_cast<uint32_t>(width));
+    append_u32_be(header, static_cast<uint32_t>(height));
+    header.insert(header.end(), { uint8_t(bit_depth), uint8_t(color_type), 0, 0, 0 });
+
+    std::ofstream ofs(path, std::ios::binary);
+    constexpr uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    ofs.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+    write_png_chunk(ofs, "IHDR", header);
+    write_png_chunk(ofs, "IDAT", zlib);
+    write_png_chunk(ofs, "IEND", {});
+    return ofs.good();
+}
+
+// A tilted floor with a few bumps in front of it, between 1 and 6 metres, and a texture
+// that isn't flat so the colors aren't all the same.
+static bool write_synthetic_pair(const bench_resolution_t& resolution, const std::filesystem::path& image_path, const std::filesystem::path& depth_path) {
+    const auto [name, width, height] = resolution;
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    std::vector<uint8_t> depth(static_cast<size_t>(width) * height * 2);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const float u = static_cast<float>(x) / width;
+            const float v = static_cast<float>(y) / height;
+            const float bumps = std::sin(u * 25.f) * std::cos(v * 17.f);
+            const float metres = 6.f - 4.f * v - .8f * std::max(bumps, 0.f);
+            // ZoeDepth stores metres scaled up by 255, big endian in the PNG.
+            const auto sample = static_cast<uint16_t>(metres * 255.f);
+
+            const size_t i = static_cast<size_t>(y) * width + x;
+            depth[i * 2] = static_cast<uint8_t>(sample >> 8);
+            depth[i * 2 + 1] = static_cast<uint8_t>(sample);
+
+            const uint32_t hash = (static_cast<uint32_t>(x) * 73856093u) ^ (static_cast<uint32_t>(y) * 19349663u);
+            rgb[i * 3] = static_cast<uint8_t>(u * 255.f);
+            rgb[i * 3 + 1] = static_cast<uint8_t>(v * 255.f);
+            rgb[i * 3 + 2] = static_cast<uint8_t>(128 + (hash & 63));
+        }
+    }
+
+    return write_stored_png(image_path, width, height, 8, 2, rgb) && write_stored_png(depth_path, width, height, 16, 0, depth);
+}
+
+static std::vector<unsigned int> parse_list(const char* arg) {
+    std::vector<unsigned int> values;
+    for (const char* str = arg; *str;) {
+        char* end = nullptr;
+        const auto value = std::strtoul(str, &end, 10);
+        if (end == str)
+            return {};
+        values.push_back(static_cast<unsigned int>(value));
+        str = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+static void print_row(const bench_row_t& row, bool json) {
+    // Failed stages keep their row, with zero throughput, so diffs show them.
+    const double seconds = row.ms > 0.0 ? row.ms / 1e3 : 0.0;
+    const double points_per_second = seconds > 0.0 ? row.points / seconds : 0.0;
+    const double bytes_per_second = seconds > 0.0 ? row.bytes / seconds : 0.0;
+
+    if (json)
+        std::printf("{\"stage\":\"%s\",\"resolution\":\"%s\",\"width\":%d,\"height\":%d,\"stride\":%u,\"threads\":%u,"
+            "\"points\":%zu,\"bytes\":%zu,\"ms\":%.3f,\"points_per_second\":%.0f,\"bytes_per_second\":%.0f}\n",
+            row.stage, row.resolution->name, row.resolution->width, row.resolution->height, row.stride, row.threads,
+            row.points, row.bytes, row.ms, points_per_second, bytes_per_second);
+    else
+        std::printf("%s,%s,%d,%d,%u,%u,%zu,%zu,%.3f,%.0f,%.0f\n",
+            row.stage, row.resolution->name, row.resolution->width, row.resolution->height, row.stride, row.threads,
+            row.points, row.bytes, row.ms, points_per_second, bytes_per_second);
+    std::fflush(stdout);
+}
+
+static void print_usage(const char* program) {
+    std::fprintf(stderr, "Usage: %s [--runs N] [--resolutions 720p,1080p,4k,8k] [--strides 1,2,...] "
+        "[--threads 1,2,...] [--format csv|json] [--dir DIR]\n", program);
+}
+
+int main(int argc, char** argv) {
+    int runs = 3;
+    std::vector<const bench_resolution_t*> resolutions;
+    std::vector<unsigned int> strides = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    std::vector<unsigned int> thread_counts;
+    bool json = false;
+    auto dir = std::filesystem::temp_directory_path() / "pipeline_bench";
+
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc)
+            runs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--resolutions" && i + 1 < argc) {
+            const std::string_view list = argv[++i];
+            for (const auto& resolution : bench_resolutions) {
+                const std::string_view name = resolution.name;
+                for (size_t first = 0; first <= list.size();) {
+                    const size_t last = std::min(list.find(',', first), list.size());
+                    if (list.substr(first, last - first) == name)
+                        resolutions.push_back(&resolution);
+                    first = last + 1;
+                }
+            }
+        }
+        else if (arg == "--strides" && i + 1 < argc)
+            strides = parse_list(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            thread_counts = parse_list(argv[++i]);
+        else if (arg == "--format" && i + 1 < argc)
+            json = std::string_view(argv[++i]) == "json";
+        else if (arg == "--dir" && i + 1 < argc)
+            dir = argv[++i];
+        else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (resolutions.empty())
+        for (const auto& resolution : bench_resolutions)
+            resolutions.push_back(&resolution);
+
+    // Powers of two up to the hardware's thread count, and the count itself.
+    if (thread_counts.empty()) {
+        const auto hardware_threads = thread_pool_t::default_thread_count();
+        for (unsigned int threads = 1; threads < hardware_threads; threads *= 2)
+            thread_counts.push_back(threads);
+        thread_counts.push_back(hardware_threads);
+    }
+
+    if (strides.empty() || thread_counts.empty() || std::ranges::count(strides, 0u) || std::ranges::count(thread_counts, 0u)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+
+    if (!json)
+        std::printf("stage,resolution,width,height,stride,threads,points,bytes,ms,points_per_second,bytes_per_second\n");
+
+    for (const auto* resolution : resolutions) {
+        const auto image_path = dir / (std::string(resolution->name) + "_rgb.png");
+        const auto depth_path = dir / (std::string(resolution->name) + "_depth.png");
+        const auto ply_path = dir / (std::string(resolution->name) + ".ply");
+        const auto cache_path = dir / (std::string(resolution->name) + ".cloud");
+
+        std::fprintf(stderr, "Writing %s inputs to %s\n", resolution->name, dir.string().c_str());
+        if (!write_synthetic_pair(*resolution, image_path, depth_path)) {
+            std::fprintf(stderr, "Failed to write the %s inputs.\n", resolution->name);
+            return EXIT_FAILURE;
+        }
+
+        const size_t pixel_count = static_cast<size_t>(resolution->width) * resolution->height;
+        const size_t encoded_bytes = std::filesystem::file_size(image_path, error) + std::filesystem::file_size(depth_path, error);
+
+        auto images = load_depth_images(image_path, depth_path);
+        if (!images) {
+            std::fprintf(stderr, "%s\n", images.error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        for (const auto threads : thread_counts) {
+            thread_pool_t pool(threads);
+
+            // Loading only ever decodes the two images side by side.
+            const double decode_ms = time_runs(runs, [&]() {
+                return load_depth_images(image_path, depth_path, threads > 1 ? &pool : nullptr).has_value();
+            });
+            print_row({ "decode", resolution, 0, threads, pixel_count, encoded_bytes, decode_ms }, json);
+
+            for (const auto stride : strides) {
+                std::fprintf(stderr, "%s stride %u with %u threads\n", resolution->name, stride, threads);
+
+                generation_output_t output = {};
+                output.layout = vertex_layout_t::full;
+                output.position_extent = glm::vec3(1.f);
+
+                const double full_ms = time_runs(runs, [&]() {
+                    auto result = generate_depth_cloud(*images, bench_intrinsics, stride, 0.f, pool);
+                    output.vertices = std::make_shared<const std::vector<vertex_t>>(std::move(result.vertices));
+                    output.max_depth = result.max_depth;
+                    return true;
+                });
+                const size_t point_count = output.vertices->size();
+                print_row({ "back_project", resolution, stride, threads, point_count, point_count * sizeof(vertex_t), full_ms }, json);
+
+                const double packed_ms = time_runs(runs, [&]() {
+                    return !generate_packed_depth_cloud(*images, bench_intrinsics, stride, 0.f, pool).vertices.empty();
+                });
+                print_row({ "back_project_packed", resolution, stride, threads, point_count, point_count * sizeof(packed_vertex_t), packed_ms }, json);
+
+                // The ray table is built on the first run, which the median leaves out.
+                const double distorted_ms = time_runs(runs, [&]() {
+                    return !generate_depth_cloud(*images, bench_distorted_intrinsics, stride, 0.f, pool).vertices.empty();
+                });
+                print_row({ "back_project_distorted", resolution, stride, threads, point_count, point_count * sizeof(vertex_t), distorted_ms }, json);
+
+                size_t filtered_count = 0;
+                const double filtered_ms = time_runs(runs, [&]() {
+                    filtered_count = generate_depth_cloud(*images, bench_intrinsics, stride, bench_flying_pixel_threshold, pool).vertices.size();
+                    return true;
+                });
+                print_row({ "back_project_filtered", resolution, stride, threads, filtered_count, filtered_count * sizeof(vertex_t), filtered_ms }, json);
+
+                size_t cell_count = 0;
+                const double voxel_ms = time_runs(runs, [&]() {
+                    cell_count = downsample_voxel_grid(*output.vertices, bench_voxel_size, pool).size();
+                    return true;
+                });
+                print_row({ "voxel_grid", resolution, stride, threads, cell_count, cell_count * sizeof(vertex_t), voxel_ms }, json);
+
+                std::vector<uint32_t> order;
+                const double octree_ms = time_runs(runs, [&]() {
+                    output.octree = build_point_octree(*output.vertices, order, pool);
+                    return !output.octree.nodes.empty();
+                });
+                print_row({ "octree", resolution, stride, threads, point_count, order.size() * sizeof(uint32_t), octree_ms }, json);
+                output.order = std::make_shared<const std::vector<uint32_t>>(std::move(order));
+
+                // Nothing to gain from more threads, so only timed once per stride.
+                if (threads == thread_counts.front()) {
+                    const double ply_ms = time_runs(runs, [&]() { return write_ply(ply_path, *output.vertices).has_value(); });
+                    print_row({ "ply", resolution, stride, 1, point_count, static_cast<size_t>(std::filesystem::file_size(ply_path, error)), ply_ms }, json);
+                }
+
+                const cloud_cache_key_t key = { 0, bench_intrinsics, stride, 0.f, 0.f, vertex_layout_t::full };
+                const double cache_ms = time_runs(runs, [&]() {
+                    return write_cloud_cache(cache_path, key, output, resolution->width, resolution->height, pool).has_value();
+                });
+                print_row({ "cloud_cache", resolution, stride, threads, point_count, static_cast<size_t>(std::filesystem::file_size(cache_path, error)), cache_ms }, json);
+            }
+        }
+
+        for (const auto& path : { image_path, depth_path, ply_path, cache_path })
+            std::filesystem::remove(path, error);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,458 @@
+// Renders a cloud offscreen along a scripted orbit and reports per-frame CPU and GPU times,
+// plus a hash of the last frame as a visual regression check. Needs no display or GPU: it
+// creates a surfaceless EGL context, which Mesa's llvmpipe provides. Built from the files in
+// src/ apart from main.cpp, and linked against EGL.
+//
+// Usage: render_bench [--size WxH] [--frames N] [--warmup N] [--stride N] [--focal-length F]
+//                     [--flying-pixel-threshold T] [--voxel-grid SIZE] [--distance D] [--voxel-scale S]
+//                     [--compact] [--sprites] [--gpu-reprojection] [--no-culling] [--no-lod] [--ui]
+//                     [--image FILE] [--shader-dir DIR] IMAGE DEPTH
+//
+// The camera starts where the viewer puts it and circles the cloud once over the measured
+// frames, bobbing up and down. Every frame waits for the GPU, so frame times are the full
+// cost of a frame rather than how fast commands can be queued. --ui draws an ImGui window
+// on top, to include the ImGui pass.
+//
+// Per-frame rows go to stdout as CSV. The summary and image hash go to stderr. The hash only
+// matches between runs on the same driver, as rasterization differs between GL
+// implementations. --image writes the last frame as a binary PPM.
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "imgui.h"
+#include "imgui_impl_opengl3.h"
+#include "camera.h"
+#include "frame_timing.h"
+#include "generation_job.h"
+#include "point_renderer.h"
+#include "point_stream.h"
+#include "thread_pool.h"
+
+struct bench_frame_t {
+    float yaw;
+    float pitch;
+    size_t drawn_points;
+    size_t draw_calls;
+    float cpu_ms;
+    float cull_ms;
+    float point_gpu_ms;
+    float ui_gpu_ms;
+    float frame_ms;
+};
+
+struct bench_stats_t {
+    float min;
+    float avg;
+    float p99;
+};
+
+// Same as timing_history_t::stats, without its window size limit.
+static bench_stats_t get_bench_stats(std::vector<float> samples) {
+    if (samples.empty())
+        return {};
+
+    std::sort(samples.begin(), samples.end());
+    float sum = 0.f;
+    for (const float sample : samples)
+        sum += sample;
+
+    const auto p99_rank = static_cast<size_t>(std::ceil(samples.size() * .99)) - 1;
+    return { samples.front(), sum / samples.size(), samples[p99_rank] };
+}
+
+// A surfaceless context when the driver has one, otherwise whatever the default display is.
+static bool create_headless_context() {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    const auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+            return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+        return false;
+
+    // The surfaceless platform may have no configs at all, which is fine as nothing is drawn
+    // to an EGL surface.
+    const EGLint config_attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    EGLint config_count = 0;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count == 0)
+        config = EGL_NO_CONFIG_KHR;
+
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    const auto context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+    // Everything is drawn into a framebuffer object, so no surface is needed.
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+static void* get_gl_proc_address(const char* name) {
+    return reinterpret_cast<void*>(eglGetProcAddress(name));
+}
+
+static uint64_t hash_pixels(const std::vector<uint8_t>& pixels) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const uint8_t byte : pixels) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// GL rows start at the bottom, PPM rows at the top.
+static bool write_ppm(const std::filesystem::path& path, int width, int height, const std::vector<uint8_t>& rgba) {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<char> row(static_cast<size_t>(width) * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++)
+                row[x * 3 + c] = static_cast<char>(rgba[(static_cast<size_t>(y) * width + x) * 4 + c]);
+        ofs.write(row.data(), static_cast<std::streamsize>(row.size()));
+    }
+    return ofs.good();
+}
+
+static float get_query_ms(GLuint query) {
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+    return static_cast<float>(static_cast<double>(ns) / 1e6);
+}
+
+static void print_usage(const char* program) {
+    std::fprintf(stderr, "Usage: %s [--size WxH] [--frames N] [--warmup N] [--stride N] [--focal-length F]\n"
+        "    [--flying-pixel-threshold T] [--voxel-grid SIZE] [--distance D] [--voxel-scale S]\n"
+        "    [--compact] [--sprites] [--gpu-reprojection] [--no-culling] [--no-lod] [--ui]\n"
+        "    [--image FILE] [--shader-dir DIR] IMAGE DEPTH\n", program);
+}
+
+int main(int argc, char** argv) {
+    int width = 1600;
+    int height = 900;
+    int frames = 360;
+    int warmup = 10;
+    unsigned int stride = 4;
+    float focal_length = 1400.f;
+    float flying_pixel_threshold = 0.f;
+    float voxel_size = 0.f;
+    float distance = 5.f;
+    float voxel_scale = .01f;
+    bool compact = false;
+    bool sprites = false;
+    bool gpu_reprojection = false;
+    bool frustum_culling = true;
+    bool level_of_detail = true;
+    bool ui = false;
+    std::string image_output;
+    std::filesystem::path shader_dir = ".";
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--size" && has_value) {
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--frames" && has_value)
+            frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--warmup" && has_value)
+            warmup = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--stride" && has_value)
+            stride = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--focal-length" && has_value)
+            focal_length = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--flying-pixel-threshold" && has_value)
+            flying_pixel_threshold = std::max(0.f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--voxel-grid" && has_value)
+            voxel_size = std::max(0.f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--distance" && has_value)
+            distance = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--voxel-scale" && has_value)
+            voxel_scale = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--compact")
+            compact = true;
+        else if (arg == "--sprites")
+            sprites = true;
+        else if (arg == "--gpu-reprojection")
+            gpu_reprojection = true;
+        else if (arg == "--no-culling")
+            frustum_culling = false;
+        else if (arg == "--no-lod")
+            level_of_detail = false;
+        else if (arg == "--ui")
+            ui = true;
+        else if (arg == "--image" && has_value)
+            image_output = argv[++i];
+        else if (arg == "--shader-dir" && has_value)
+            shader_dir = argv[++i];
+        else if (!arg.starts_with("--"))
+            inputs.emplace_back(arg);
+        else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (inputs.size() != 2) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!create_headless_context()) {
+        std::fprintf(stderr, "Failed to create a headless GL 4.1 core context through EGL.\n");
+        return EXIT_FAILURE;
+    }
+    if (!gladLoadGLLoader(get_gl_proc_address)) {
+        std::fprintf(stderr, "GLAD loading failure.\n");
+        return EXIT_FAILURE;
+    }
+    std::fprintf(stderr, "Renderer: %s\n", reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    auto renderer_result = point_renderer_t::create(shader_dir / "shader.vs", shader_dir / "shader.fs");
+    if (!renderer_result) {
+        std::fprintf(stderr, "Failed to create shader program: %s\n", renderer_result.error().c_str());
+        return EXIT_FAILURE;
+    }
+    const auto renderer = std::move(*renderer_result);
+
+    GLuint framebuffer, color_buffer, depth_buffer;
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &color_buffer);
+    glGenRenderbuffers(1, &depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::fprintf(stderr, "Failed to create a %dx%d framebuffer.\n", width, height);
+        return EXIT_FAILURE;
+    }
+    glViewport(0, 0, width, height);
+
+    // Generated the same way as the viewer does, minus the cache so every run does the same work.
+    thread_pool_t pool;
+    const generation_request_t request {
+        .image_path = inputs[0],
+        .depth_path = inputs[1],
+        .intrinsics = make_pinhole_intrinsics(focal_length),
+        .stride = stride,
+        .flying_pixel_threshold = flying_pixel_threshold,
+        .voxel_size = voxel_size,
+        .images_only = gpu_reprojection,
+        .layout = compact ? vertex_layout_t::packed : vertex_layout_t::full,
+        .cache_dir = {},
+        .cache_byte_budget = 0,
+        .image_cache = nullptr,
+        .images = nullptr
+    };
+    generation_job_t job(request, pool, nullptr);
+    while (!job.finished())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    auto result = job.take_result();
+    if (!result) {
+        std::fprintf(stderr, "%s\n", result.error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    GLuint point_cloud_vbo;
+    glGenBuffers(1, &point_cloud_vbo);
+    point_stream_t point_stream;
+    std::optional<point_cloud_t> point_cloud;
+    const float max_depth = (*result).max_depth;
+
+    if ((*result).images)
+        renderer->upload_depth_textures(*(*result).images);
+    else {
+        point_cloud = point_cloud_t {
+            .layout = (*result).layout,
+            .count = 0,
+            .position_offset = (*result).position_offset,
+            .position_extent = (*result).position_extent,
+            .octree = std::move((*result).octree),
+            .uploaded = 0
+        };
+        (*point_cloud).count = point_stream.begin(point_cloud_vbo, std::move(*result));
+        // Uploaded up front, streaming is not what is being measured.
+        while (point_stream.active())
+            (*point_cloud).uploaded = point_stream.update(pool);
+        renderer->bind_point_cloud(point_cloud_vbo, (*point_cloud).layout);
+    }
+    glFinish();
+
+    if (ui) {
+        ImGui::CreateContext();
+        ImGuiIO& io = ImGui::GetIO();
+        // No platform backend, so the display and clock are driven by hand, at a fixed step so
+        // the UI looks the same every run.
+        io.IniFilename = nullptr;
+        io.DisplaySize = ImVec2(static_cast<float>(width), static_cast<float>(height));
+        io.DeltaTime = 1.f / 60.f;
+        ImGui::StyleColorsDark();
+        ImGui_ImplOpenGL3_Init("#version 410");
+    }
+
+    GLuint queries[2];
+    glGenQueries(2, queries);
+    const auto [point_query, ui_query] = queries;
+
+    camera_t camera {
+        .origin = glm::vec3(0.f, 0.f, max_depth),
+        .distance = distance,
+        .pitch = 0.f,
+        .yaw = 90.f,
+        .rotate_speed = .1f,
+        .pan_speed = .005f,
+        .zoom_scale = .1f
+    };
+
+    const auto projection_mat = glm::perspective(glm::radians(65.0f), static_cast<float>(width) / height, 0.1f, 1000.0f);
+    std::vector<bench_frame_t> results;
+    std::vector<float> drawn_history;
+
+    for (int frame = -warmup; frame < frames; frame++) {
+        // Warmup frames stay at the start of the orbit.
+        const float t = static_cast<float>(std::max(frame, 0)) / frames;
+        camera.yaw = 90.f + 360.f * t;
+        camera.pitch = 20.f * std::sin(2.f * std::numbers::pi_v<float> * t);
+
+        cpu_timer_t frame_timer;
+
+        glClearColor(0.f, 0.f, 0.f, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        const point_draw_settings_t draw_settings {
+            .projection = projection_mat,
+            .view = get_camera_view_matrix(camera),
+            .viewport_height = static_cast<float>(height),
+            .render_mode = sprites ? render_mode_t::sprite : render_mode_t::cube,
+            .splat_shape = splat_shape_t::round,
+            .voxel_scale = voxel_scale,
+            .frustum_culling = frustum_culling,
+            .level_of_detail = level_of_detail,
+            .lod_point_spacing = 1.f,
+            .lod_point_budget = 10'000'000,
+            .stride = stride,
+            .intrinsics = make_pinhole_intrinsics(focal_length)
+        };
+
+        glBeginQuery(GL_TIME_ELAPSED, point_query);
+        const auto draw_stats = renderer->draw(point_cloud ? &*point_cloud : nullptr, draw_settings);
+        glEndQuery(GL_TIME_ELAPSED);
+        const float cpu_ms = frame_timer.elapsed_ms();
+
+        if (ui) {
+            glBeginQuery(GL_TIME_ELAPSED, ui_query);
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui::NewFrame();
+            ImGui::SetNextWindowPos(ImVec2(10.f, 10.f));
+            ImGui::Begin("Render Benchmark", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+            // Nothing timing dependent, so the image hash stays stable.
+            ImGui::Text("Frame: %d / %d", std::max(frame, 0) + 1, frames);
+            ImGui::Text("Drawn Vertices: %zu", draw_stats.drawn_points);
+            ImGui::Text("Draw Calls: %zu", draw_stats.draw_calls);
+            ImGui::ProgressBar(t);
+            if (!drawn_history.empty())
+                ImGui::PlotLines("Drawn", drawn_history.data(), static_cast<int>(drawn_history.size()), 0, nullptr, 0.f, FLT_MAX, ImVec2(0.f, 40.f));
+            ImGui::End();
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+
+        glFinish();
+        const float frame_ms = frame_timer.elapsed_ms();
+
+        if (frame < 0)
+            continue;
+
+        drawn_history.push_back(static_cast<float>(draw_stats.drawn_points));
+        results.push_back({
+            .yaw = camera.yaw,
+            .pitch = camera.pitch,
+            .drawn_points = draw_stats.drawn_points,
+            .draw_calls = draw_stats.draw_calls,
+            .cpu_ms = cpu_ms,
+            .cull_ms = draw_stats.cull_ms.value_or(0.f),
+            .point_gpu_ms = get_query_ms(point_query),
+            .ui_gpu_ms = ui ? get_query_ms(ui_query) : 0.f,
+            .frame_ms = frame_ms
+        });
+    }
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    std::printf("frame,yaw,pitch,drawn_points,draw_calls,cpu_ms,cull_ms,point_gpu_ms,ui_gpu_ms,frame_ms\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& frame = results[i];
+        std::printf("%zu,%.3f,%.3f,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f\n", i, frame.yaw, frame.pitch, frame.drawn_points,
+            frame.draw_calls, frame.cpu_ms, frame.cull_ms, frame.point_gpu_ms, frame.ui_gpu_ms, frame.frame_ms);
+    }
+
+    const auto summarize = [&](const char* name, float bench_frame_t::* member) {
+        std::vector<float> samples;
+        for (const auto& frame : results)
+            samples.push_back(frame.*member);
+        const auto stats = get_bench_stats(std::move(samples));
+        std::fprintf(stderr, "%-14s min %8.3f  avg %8.3f  p99 %8.3f ms\n", name, stats.min, stats.avg, stats.p99);
+    };
+    summarize("CPU", &bench_frame_t::cpu_ms);
+    summarize("Culling/LOD", &bench_frame_t::cull_ms);
+    summarize("Point Pass", &bench_frame_t::point_gpu_ms);
+    if (ui)
+        summarize("ImGui Pass", &bench_frame_t::ui_gpu_ms);
+    summarize("Frame", &bench_frame_t::frame_ms);
+    std::fprintf(stderr, "Image hash: %016llx\n", static_cast<unsigned long long>(hash_pixels(pixels)));
+
+    if (!image_output.empty() && !write_ppm(image_output, width, height, pixels)) {
+        std::fprintf(stderr, "Failed to write %s.\n", image_output.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (ui) {
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui::DestroyContext();
+    }
+
+    return EXIT_SUCCESS;
+}
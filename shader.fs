@@ -2,9 +2,19 @@
 
 in vec3 out_vert_color;
 
+// Only used when drawing sprites. 0 is a square splat, 1 is round.
+uniform bool sprite;
+uniform int splat_shape;
+
 out vec4 frag_color;
 
 void main()
 {
+	if (sprite && splat_shape == 1) {
+		vec2 from_center = gl_PointCoord * 2.0 - 1.0;
+		if (dot(from_center, from_center) > 1.0)
+			discard;
+	}
+
 	frag_color = vec4(out_vert_color, 1.f);
 }
\ No newline at end of file
@@ -8,10 +8,64 @@ uniform mat4 projection_matrix;
 uniform mat4 view_matrix;
 uniform mat4 model_matrix;
 
+// Dequantizes packed 16-bit positions, which arrive normalized to [0, 1] within the cloud's
+// bounds. Full float positions use an offset of 0 and an extent of 1.
+uniform vec3 position_offset;
+uniform vec3 position_extent;
+
+// GPU reprojection, where each instance is a pixel of the depth map instead of a VBO entry.
+uniform bool reproject;
+uniform usampler2D depth_texture;
+// Float depth maps are sampled in metres from here instead.
+uniform bool metric_depth;
+uniform sampler2D metric_depth_texture;
+uniform sampler2D color_texture;
+uniform int stride;
+// Pinhole intrinsics in pixels. Lens distortion is only undistorted on the CPU.
+uniform vec2 focal_length;
+uniform vec2 principal_point;
+
+// Sprite rendering, where each point is one GL_POINTS vertex instead of a cube instance.
+uniform bool sprite;
+uniform float voxel_scale;
+uniform float viewport_height;
+
 out vec3 out_vert_color;
 
 void main()
 {
-    gl_Position = projection_matrix * view_matrix * (model_matrix * vec4(vert_pos, 1.0) + vec4(vert_offset, 1.0));
-    out_vert_color = vert_color;
+    vec3 offset = position_offset + vert_offset * position_extent;
+    vec3 color = vert_color;
+
+    // Sprites are plain vertices, so the point is identified by the vertex rather than the instance.
+    int point_index = sprite ? gl_VertexID : gl_InstanceID;
+    vec3 pos = sprite ? vec3(0.0) : vert_pos;
+
+    if (reproject) {
+        ivec2 size = textureSize(color_texture, 0);
+        int columns = (size.x + stride - 1) / stride;
+        ivec2 texel = ivec2(point_index % columns, point_index / columns) * stride;
+
+        float depth;
+        if (metric_depth) {
+            // Samples without a valid depth end up at 0, as on the CPU.
+            depth = texelFetch(metric_depth_texture, texel, 0).r;
+            if (!(depth > 0.0) || isinf(depth))
+                depth = 0.0;
+        }
+        else {
+            // ZoeDepth maps are metric scaled down by 255.
+            depth = float(texelFetch(depth_texture, texel, 0).r) / 255.0;
+        }
+
+        offset = vec3(depth * (principal_point - vec2(texel)) / focal_length, depth);
+        color = texelFetch(color_texture, texel, 0).rgb;
+    }
+
+    gl_Position = projection_matrix * view_matrix * (model_matrix * vec4(pos, 1.0) + vec4(offset, 1.0));
+    out_vert_color = color;
+
+    // Match the on-screen size of a cube, which spans 2 units before model scaling.
+    if (sprite)
+        gl_PointSize = max(1.0, voxel_scale * projection_matrix[1][1] * viewport_height / gl_Position.w);
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include "depth_cloud.h"
+#include "ply.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "voxel_grid.h"
+
+using batch_clock_t = std::chrono::steady_clock;
+
+std::expected<std::vector<batch_item_t>, std::string> read_batch_manifest(const std::filesystem::path& path) {
+    std::ifstream ifs(path);
+    if (ifs.fail())
+        return std::unexpected("Failed to open manifest " + path.string() + ".");
+
+    const auto base = path.parent_path();
+    const auto resolve = [&](const std::string& entry) {
+        const std::filesystem::path entry_path = entry;
+        return entry_path.is_relative() ? base / entry_path : entry_path;
+    };
+
+    std::vector<batch_item_t> items;
+    std::string line;
+    for (size_t line_number = 1; std::getline(ifs, line); line_number++) {
+        std::istringstream fields(line);
+        std::string image, depth, output;
+        if (!(fields >> image) || image.starts_with('#'))
+            continue;
+
+        if (!(fields >> depth))
+            return std::unexpected(path.string() + ":" + std::to_string(line_number) + ": expected an image and a depth path.");
+
+        auto& item = items.emplace_back(resolve(image), resolve(depth));
+        if (fields >> output)
+            item.output_path = resolve(output);
+    }
+
+    return items;
+}
+
+int run_batch(const batch_options_t& options, thread_pool_t& pool) {
+    if (options.items.empty()) {
+        std::cerr << "No inputs to convert." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Resolved up front, so items that would overwrite each other fail before any is converted.
+    std::vector<std::filesystem::path> output_paths;
+    output_paths.reserve(options.items.size());
+    std::map<std::filesystem::path, size_t> output_items;
+    for (size_t index = 0; index < options.items.size(); index++) {
+        const auto& item = options.items[index];
+        const auto& output_path = output_paths.emplace_back(item.output_path.empty()
+            ? options.output_dir / (std::filesystem::path(item.image_path.stem()) += ".ply")
+            : item.output_path);
+
+        std::error_code error;
+        const auto resolved = std::filesystem::absolute(output_path, error).lexically_normal();
+        const auto [existing, inserted] = output_items.emplace(error ? output_path.lexically_normal() : resolved, index);
+        if (!inserted) {
+            std::cerr << options.items[existing->second].image_path.string() << " and " << item.image_path.string()
+                << " would both be written to " << output_path.string() << ". Give them output paths in a manifest." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Manifest outputs can be anywhere, not just in output_dir. A directory that can't be
+    // created fails that item's write.
+    std::error_code error;
+    for (const auto& output_path : output_paths) {
+        if (output_path.has_parent_path())
+            std::filesystem::create_directories(output_path.parent_path(), error);
+    }
+
+    const unsigned int jobs = options.jobs ? options.jobs : pool.thread_count();
+    const size_t lanes = std::min<size_t>(jobs, options.items.size());
+
+    std::atomic<size_t> next_item = 0;
+    std::atomic<size_t> failed = 0;
+    std::atomic<size_t> total_points = 0;
+    std::atomic<uintmax_t> total_bytes = 0;
+    std::mutex print_mutex;
+
+    const auto batch_start = batch_clock_t::now();
+
+    // Each lane converts one file at a time, so no more than lanes clouds are held in memory.
+    // Lanes run on the pool, and the row bands of the file they are working on fill in
+    // whichever workers the other lanes leave idle.
+    pool.parallel_for(lanes, [&](size_t) {
+        for (size_t index = next_item++; index < options.items.size(); index = next_item++) {
+            const auto& item = options.items[index];
+            const auto& output_path = output_paths[index];
+
+            TRACE_SCOPE("batch item");
+            const auto start = batch_clock_t::now();
+
+            auto cloud = generate_depth_cloud(item.image_path, item.depth_path, options.intrinsics, options.stride, options.flying_pixel_threshold, pool);
+            if (cloud && options.voxel_size > 0.f)
+                cloud->vertices = downsample_voxel_grid(cloud->vertices, options.voxel_size, pool);
+            std::expected<void, std::string> written = cloud
+                ? write_ply(output_path, cloud->vertices)
+                : std::unexpected(cloud.error());
+
+            const double seconds = std::chrono::duration<double>(batch_clock_t::now() - start).count();
+
+            std::lock_guard lock(print_mutex);
+            if (!written) {
+                failed++;
+                std::cerr << item.image_path.string() << ": " << written.error() << std::endl;
+                continue;
+            }
+
+            const size_t points = cloud->vertices.size();
+            const uintmax_t bytes = std::filesystem::file_size(output_path, error);
+            total_points += points;
+            total_bytes += error ? 0 : bytes;
+
+            char line[128];
+            std::snprintf(line, sizeof(line), "%zu points in %.1f ms (%.2f Mpts/s)",
+                points, seconds * 1000.0, points / seconds / 1e6);
+            std::cout << item.image_path.string() << " -> " << output_path.string() << ": " << line << std::endl;
+        }
+    });
+
+    const double seconds = std::chrono::duration<double>(batch_clock_t::now() - batch_start).count();
+    const size_t converted = options.items.size() - failed;
+
+    char summary[192];
+    std::snprintf(summary, sizeof(summary),
+        "Converted %zu of %zu files in %.2f s: %.2f files/s, %.2f Mpts/s, %.1f MB/s written (%u jobs, %u threads)",
+        converted, options.items.size(), seconds, converted / seconds, total_points / seconds / 1e6,
+        total_bytes / seconds / 1e6, static_cast<unsigned int>(lanes), pool.thread_count());
+    std::cout << summary << std::endl;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
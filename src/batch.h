@@ -0,0 +1,38 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "ray_table.h"
+
+class thread_pool_t;
+
+struct batch_item_t {
+    std::filesystem::path image_path;
+    std::filesystem::path depth_path;
+    // Empty to write <output_dir>/<image stem>.ply.
+    std::filesystem::path output_path;
+};
+
+struct batch_options_t {
+    std::vector<batch_item_t> items;
+    std::filesystem::path output_dir = ".";
+    camera_intrinsics_t intrinsics = make_pinhole_intrinsics(1400.f);
+    unsigned int stride = 1;
+    // 0 keeps every sample, see filter_flying_pixels.
+    float flying_pixel_threshold = 0.f;
+    // 0 keeps every point, see downsample_voxel_grid.
+    float voxel_size = 0.f;
+    // Files in flight at once, which bounds memory use. 0 uses the pool's thread count.
+    unsigned int jobs = 0;
+};
+
+// Reads a manifest with one "image depth [output]" entry per line. Blank lines and lines
+// starting with # are skipped, and relative paths are resolved against the manifest's directory.
+std::expected<std::vector<batch_item_t>, std::string> read_batch_manifest(const std::filesystem::path& path);
+
+// Converts every item to a binary PLY without touching SDL or GL, printing per-file and
+// aggregate throughput. Fails without converting anything if two items would be written to the
+// same file. Returns the process exit code.
+int run_batch(const batch_options_t& options, thread_pool_t& pool);
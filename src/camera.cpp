@@ -0,0 +1,20 @@
+#include "camera.h"
+
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+glm::vec3 get_camera_front(float pitch, float yaw) {
+    auto front = glm::vec3();
+    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    front.y = sin(glm::radians(pitch));
+    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    return glm::normalize(front);
+}
+
+glm::vec3 get_camera_position(const camera_t& camera) {
+    return camera.origin - get_camera_front(camera.pitch, camera.yaw) * camera.distance;
+}
+
+glm::mat4 get_camera_view_matrix(const camera_t& camera) {
+    return glm::lookAt(get_camera_position(camera), camera.origin, glm::vec3(0.f, 1.f, 0.f));
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Orbits origin at distance, looking at it from the direction given by pitch and yaw in degrees.
+struct camera_t {
+    glm::vec3 origin;
+    float distance;
+    float pitch;
+    float yaw;
+    float rotate_speed;
+    float pan_speed;
+    float zoom_scale;
+};
+
+glm::vec3 get_camera_front(float pitch, float yaw);
+glm::vec3 get_camera_position(const camera_t& camera);
+glm::mat4 get_camera_view_matrix(const camera_t& camera);
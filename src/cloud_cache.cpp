@@ -0,0 +1,267 @@
+#include "cloud_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include "mapped_file.h"
+#include "octree.h"
+
+static constexpr char cloud_cache_magic[8] = { 'Z', 'P', 'C', 'L', 'O', 'U', 'D', '\0' };
+static constexpr uint32_t cloud_cache_version = 4;
+// Keeps the vertex stream page aligned within the mapping.
+static constexpr uint64_t cloud_cache_alignment = 4096;
+// Points reordered per write.
+static constexpr size_t cloud_cache_chunk_points = 256 * 1024;
+
+static_assert(std::is_trivially_copyable_v<cloud_cache_header_t>);
+static_assert(std::is_trivially_copyable_v<camera_intrinsics_t>);
+static_assert(std::is_trivially_copyable_v<vertex_t>);
+static_assert(std::is_trivially_copyable_v<packed_vertex_t>);
+static_assert(std::is_trivially_copyable_v<octree_node_t>);
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Word at a time multiply-xorshift hash. Not cryptographic, but plenty to tell sources apart,
+// and fast enough that hashing is dwarfed by reading the file in.
+static uint64_t hash_bytes(std::span<const std::byte> bytes, uint64_t hash) {
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+    const auto mix = [](uint64_t hash, uint64_t word) {
+        hash = (hash ^ word) * prime;
+        return hash ^ (hash >> 32);
+    };
+
+    hash = mix(hash, bytes.size());
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = mix(hash, word);
+    }
+
+    // An empty span may have a null data pointer, which memcpy mustn't be given.
+    uint64_t tail = 0;
+    if (i < bytes.size())
+        std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    return mix(hash, tail);
+}
+
+std::expected<uint64_t, std::string> hash_source_files(const std::filesystem::path& image_path, const std::filesystem::path& depth_path) {
+    uint64_t hash = 0;
+    for (const auto& path : { image_path, depth_path }) {
+        auto file = mapped_file_t::open(path);
+        if (!file)
+            return std::unexpected(file.error());
+        hash = hash_bytes(file->bytes(), hash);
+    }
+    return hash;
+}
+
+std::filesystem::path default_cloud_cache_dir() {
+    std::error_code error;
+    const auto temp = std::filesystem::temp_directory_path(error);
+    return (error ? std::filesystem::path(".") : temp) / "zoe-pointcloud";
+}
+
+std::filesystem::path get_cloud_cache_path(const std::filesystem::path& cache_dir, const cloud_cache_key_t& key) {
+    const uint64_t parameters[] = {
+        key.source_hash,
+        key.stride,
+        std::bit_cast<uint32_t>(key.flying_pixel_threshold),
+        std::bit_cast<uint32_t>(key.voxel_size),
+        static_cast<uint64_t>(key.layout),
+        cloud_cache_version
+    };
+    uint64_t hash = hash_bytes(std::as_bytes(std::span(parameters)), 0);
+    hash = hash_bytes(std::as_bytes(std::span(&key.intrinsics, 1)), hash);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.cloud", static_cast<unsigned long long>(hash));
+    return cache_dir / name;
+}
+
+void trim_cloud_cache(const std::filesystem::path& cache_dir, uint64_t byte_budget) {
+    struct cached_file_t {
+        std::filesystem::path path;
+        std::filesystem::file_time_type modified;
+        uint64_t size;
+    };
+
+    // Only finished clouds, as temporary files belong to writes still in flight.
+    std::vector<cached_file_t> files;
+    uint64_t total = 0;
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(cache_dir, error); !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+        if (it->path().extension() != ".cloud")
+            continue;
+
+        std::error_code file_error;
+        const auto size = it->file_size(file_error);
+        const auto modified = it->last_write_time(file_error);
+        if (file_error)
+            continue;
+
+        files.push_back(cached_file_t { it->path(), modified, size });
+        total += size;
+    }
+
+    if (total <= byte_budget)
+        return;
+
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.modified < b.modified; });
+    for (const auto& file : files) {
+        if (total <= byte_budget)
+            break;
+        if (std::filesystem::remove(file.path, error))
+            total -= file.size;
+    }
+}
+
+std::expected<void, std::string> write_cloud_cache(
+    const std::filesystem::path& path,
+    const cloud_cache_key_t& key,
+    const generation_output_t& output,
+    uint32_t image_width,
+    uint32_t image_height,
+    thread_pool_t& pool
+) {
+    const bool packed = output.layout == vertex_layout_t::packed;
+    const size_t vertex_size = packed ? sizeof(packed_vertex_t) : sizeof(vertex_t);
+    const size_t point_count = packed ? output.packed_vertices->size() : output.vertices->size();
+    const auto nodes = std::as_bytes(std::span(output.octree.nodes));
+
+    cloud_cache_header_t header {};
+    std::memcpy(header.magic, cloud_cache_magic, sizeof(header.magic));
+    header.version = cloud_cache_version;
+    header.layout = static_cast<uint32_t>(output.layout);
+    header.source_hash = key.source_hash;
+    header.intrinsics = key.intrinsics;
+    header.stride = key.stride;
+    header.flying_pixel_threshold = key.flying_pixel_threshold;
+    header.voxel_size = key.voxel_size;
+    header.image_width = image_width;
+    header.image_height = image_height;
+    header.point_count = point_count;
+    header.vertex_size = static_cast<uint32_t>(vertex_size);
+    header.node_count = static_cast<uint32_t>(output.octree.nodes.size());
+    if (!output.octree.nodes.empty()) {
+        header.bounds_min = output.octree.nodes[0].bounds_min;
+        header.bounds_max = output.octree.nodes[0].bounds_max;
+    }
+    header.position_offset = output.position_offset;
+    header.position_extent = output.position_extent;
+    header.max_depth = output.max_depth;
+    header.vertex_offset = align_up(sizeof(header), cloud_cache_alignment);
+    header.node_offset = align_up(header.vertex_offset + point_count * vertex_size, alignof(octree_node_t));
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Unique per write, as a cloud can be written again before an earlier write of it finishes.
+    static std::atomic<uint64_t> write_count = 0;
+    auto temp_path = path;
+    temp_path += "." + std::to_string(write_count++) + ".tmp";
+
+    {
+        std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+        if (ofs.fail())
+            return std::unexpected("Failed to open " + temp_path.string() + " for writing.");
+
+        const auto write_at = [&](uint64_t offset, std::span<const std::byte> bytes) {
+            ofs.seekp(static_cast<std::streamoff>(offset));
+            ofs.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        };
+
+        write_at(0, std::as_bytes(std::span(&header, 1)));
+        // Gathered into octree order a chunk at a time, rather than reordering a whole copy.
+        std::vector<std::byte> chunk(std::min(point_count, cloud_cache_chunk_points) * vertex_size);
+        ofs.seekp(static_cast<std::streamoff>(header.vertex_offset));
+        for (size_t first = 0; first < point_count; first += cloud_cache_chunk_points) {
+            const size_t count = std::min(cloud_cache_chunk_points, point_count - first);
+            if (packed)
+                gather_points(*output.packed_vertices, *output.order, first, count, reinterpret_cast<packed_vertex_t*>(chunk.data()), pool);
+            else
+                gather_points(*output.vertices, *output.order, first, count, reinterpret_cast<vertex_t*>(chunk.data()), pool);
+            ofs.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(count * vertex_size));
+        }
+
+        write_at(header.node_offset, nodes);
+
+        if (ofs.fail())
+            return std::unexpected("Failed to write " + temp_path.string() + ".");
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return std::unexpected("Failed to move the cache into place at " + path.string() + ".");
+    }
+
+    return {};
+}
+
+std::expected<generation_output_t, std::string> read_cloud_cache(const std::filesystem::path& path, const cloud_cache_key_t& key) {
+    auto file = mapped_file_t::open(path);
+    if (!file)
+        return std::unexpected(file.error());
+
+    const auto bytes = file->bytes();
+    if (bytes.size() < sizeof(cloud_cache_header_t))
+        return std::unexpected(path.string() + " is truncated.");
+
+    cloud_cache_header_t header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+
+    const bool packed = header.layout == static_cast<uint32_t>(vertex_layout_t::packed);
+    const uint32_t vertex_size = packed ? sizeof(packed_vertex_t) : sizeof(vertex_t);
+
+    if (std::memcmp(header.magic, cloud_cache_magic, sizeof(header.magic)) != 0 || header.version != cloud_cache_version)
+        return std::unexpected(path.string() + " is not a cloud cache of this version.");
+
+    if (header.source_hash != key.source_hash
+        || header.intrinsics != key.intrinsics
+        || header.stride != key.stride
+        || header.flying_pixel_threshold != key.flying_pixel_threshold
+        || header.voxel_size != key.voxel_size
+        || header.layout != static_cast<uint32_t>(key.layout)
+        || header.vertex_size != vertex_size)
+        return std::unexpected(path.string() + " was generated from different sources or parameters.");
+
+    // Compared by division against what's left after each offset, so a corrupt count or
+    // offset can't overflow past the check.
+    if (header.vertex_offset > bytes.size()
+        || header.point_count > (bytes.size() - header.vertex_offset) / vertex_size
+        || header.node_offset > bytes.size()
+        || header.node_offset % alignof(octree_node_t) != 0
+        || header.node_count > (bytes.size() - header.node_offset) / sizeof(octree_node_t))
+        return std::unexpected(path.string() + " is truncated.");
+    const uint64_t vertex_bytes = header.point_count * vertex_size;
+
+    generation_output_t output {
+        .images = nullptr,
+        .layout = key.layout,
+        .vertices = {},
+        .packed_vertices = {},
+        .order = {},
+        .position_offset = header.position_offset,
+        .position_extent = header.position_extent,
+        .octree = {},
+        .max_depth = header.max_depth,
+        .cache_file = {},
+        .cached_vertices = bytes.subspan(header.vertex_offset, vertex_bytes)
+    };
+
+    // The nodes are small, and the culling code wants them in a vector.
+    const auto nodes = reinterpret_cast<const octree_node_t*>(bytes.data() + header.node_offset);
+    output.octree.nodes.assign(nodes, nodes + header.node_count);
+
+    // Moving the mapping doesn't move the pages, so cached_vertices stays valid.
+    output.cache_file = std::move(*file);
+    return output;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <string>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+#include "generation_job.h"
+
+class thread_pool_t;
+
+// Everything a cached cloud depends on. Any change means regenerating.
+struct cloud_cache_key_t {
+    uint64_t source_hash;
+    camera_intrinsics_t intrinsics;
+    uint32_t stride;
+    float flying_pixel_threshold;
+    float voxel_size;
+    vertex_layout_t layout;
+};
+
+// On-disk layout of a cache file. The vertex stream and octree nodes follow at the given
+// offsets, stored exactly as they are uploaded and used, so loading is a mapping.
+struct cloud_cache_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t source_hash;
+    // Intrinsics as requested, so with the principal point unresolved, and the source image size.
+    camera_intrinsics_t intrinsics;
+    uint32_t stride;
+    uint32_t image_width;
+    uint32_t image_height;
+    uint64_t point_count;
+    uint32_t vertex_size;
+    uint32_t node_count;
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    glm::vec3 position_offset;
+    glm::vec3 position_extent;
+    float max_depth;
+    // Generation parameters like the intrinsics, here as they fill what would be padding.
+    float flying_pixel_threshold;
+    float voxel_size;
+    uint32_t reserved;
+    // Page aligned.
+    uint64_t vertex_offset;
+    uint64_t node_offset;
+};
+
+// Hashes the contents of both source files.
+std::expected<uint64_t, std::string> hash_source_files(const std::filesystem::path& image_path, const std::filesystem::path& depth_path);
+
+std::filesystem::path default_cloud_cache_dir();
+// Where a cloud with this key is stored within the cache directory.
+std::filesystem::path get_cloud_cache_path(const std::filesystem::path& cache_dir, const cloud_cache_key_t& key);
+
+// Removes clouds from cache_dir, oldest modified first, until the rest fit in byte_budget.
+// Files that can't be inspected or removed are skipped.
+void trim_cloud_cache(const std::filesystem::path& cache_dir, uint64_t byte_budget);
+
+// Writes the points in octree order. Writes to a temporary file first, so a partially written cache is never picked up.
+std::expected<void, std::string> write_cloud_cache(
+    const std::filesystem::path& path,
+    const cloud_cache_key_t& key,
+    const generation_output_t& output,
+    uint32_t image_width,
+    uint32_t image_height,
+    thread_pool_t& pool
+);
+
+// Maps a cache file and checks it against the key. The vertices are left in the mapping.
+std::expected<generation_output_t, std::string> read_cloud_cache(const std::filesystem::path& path, const cloud_cache_key_t& key);
@@ -0,0 +1,355 @@
+#include "depth_cloud.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <optional>
+#include "depth_filter.h"
+#include "depth_kernel.h"
+#include "float_depth.h"
+#include "image_decoder.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+std::expected<depth_images_t, std::string> load_depth_images(
+    const std::filesystem::path& image_path,
+    const std::filesystem::path& depth_path,
+    thread_pool_t* pool
+) {
+    std::expected<decoded_rgb_image_t, std::string> rgb = std::unexpected(std::string());
+    std::expected<decoded_depth_image_t, std::string> depth = std::unexpected(std::string());
+    std::expected<float_depth_image_t, std::string> metric_depth = std::unexpected(std::string());
+    const bool float_depth = is_float_depth_path(depth_path);
+
+    // Files are mapped or read by the decoders, so their I/O is part of these spans.
+    const auto decode = [&](size_t index) {
+        if (index == 0) {
+            TRACE_SCOPE("decode color");
+            rgb = decode_rgb_image(pick_image_decoder(image_path), image_path);
+        }
+        else if (float_depth) {
+            TRACE_SCOPE("read float depth");
+            metric_depth = read_float_depth(depth_path);
+        }
+        else {
+            TRACE_SCOPE("decode depth");
+            depth = decode_depth_image(pick_image_decoder(depth_path), depth_path);
+        }
+    };
+
+    // Both decoders are single threaded, so decode the two files side by side.
+    if (pool)
+        pool->parallel_for(2, decode);
+    else {
+        decode(0);
+        decode(1);
+    }
+
+    if (float_depth && !metric_depth)
+        return std::unexpected(metric_depth.error());
+
+    if (!rgb || (!float_depth && !depth))
+        return std::unexpected("Failed to read image or depth map.");
+
+    const int depth_width = float_depth ? metric_depth->width : depth->width;
+    const int depth_height = float_depth ? metric_depth->height : depth->height;
+    const int depth_channels = float_depth ? 1 : depth->channels;
+    if (rgb->width != depth_width || rgb->height != depth_height || rgb->channels != 3 || depth_channels != 1)
+        return std::unexpected("Image and depth map not same resolution or invalid channel count.");
+
+    return depth_images_t {
+        .width = rgb->width,
+        .height = rgb->height,
+        .rgb = std::move(rgb->pixels),
+        .depth = float_depth ? nullptr : std::move(depth->pixels),
+        .metric_depth = float_depth ? std::move(metric_depth->depth) : metric_depth_t {}
+    };
+}
+
+size_t get_depth_cloud_size(int width, int height, unsigned int stride) {
+    return static_cast<size_t>((width + stride - 1) / stride) * ((height + stride - 1) / stride);
+}
+
+float get_max_depth(const depth_images_t& images) {
+    const size_t count = static_cast<size_t>(images.width) * images.height;
+
+    if (images.metric_depth.data) {
+        // Invalid samples count as 0, as the kernels treat them.
+        float max_depth = 0.f;
+        for (size_t i = 0; i < count; i++) {
+            const float depth = images.metric_depth.data[i];
+            if (depth > max_depth && depth <= FLT_MAX)
+                max_depth = depth;
+        }
+        return max_depth;
+    }
+
+    const uint16_t max_gray = count ? *std::max_element(images.depth.get(), images.depth.get() + count) : 0;
+    return static_cast<float>(max_gray) * (1.f / 255.f);
+}
+
+// The samples [begin, begin + count) of a run.
+static depth_run_t slice_run(const depth_run_t& run, size_t begin, size_t count) {
+    auto slice = run;
+    if (slice.depth)
+        slice.depth += begin;
+    if (slice.metric_depth)
+        slice.metric_depth += begin;
+    slice.rgb += begin * 3;
+    slice.x_factors += begin;
+    if (slice.y_factors)
+        slice.y_factors += begin;
+    slice.count = count;
+    return slice;
+}
+
+// Runs the back-projection kernel over every sampled row, in bands of rows across the pool.
+// project_run(first, run) gets a run of input with run.out unset and the index of its first
+// point in the output, and returns the run's max depth. With a filter, only the runs of kept
+// samples are projected, packed one after another from the row's offset. Returns the max
+// depth over all rows.
+template <typename RunFn>
+static float back_project_rows(
+    const depth_images_t& images,
+    const ray_table_t& rays,
+    unsigned int stride,
+    const depth_filter_result_t* filter,
+    thread_pool_t& pool,
+    generation_progress_t* progress,
+    RunFn&& project_run
+) {
+    const int w1 = images.width;
+    const uint8_t* pixels1 = images.rgb.get();
+    const uint16_t* pixels2 = images.depth.get();
+    const float* metric_pixels = images.metric_depth.data;
+
+    const size_t columns = rays.columns;
+    const size_t rows = rays.rows;
+
+    // A few bands per thread so a slow band doesn't leave the others idle.
+    const size_t band_count = std::min<size_t>(rows, pool.thread_count() * 4);
+    const size_t rows_per_band = band_count ? (rows + band_count - 1) / band_count : 0;
+    std::vector<float> band_max_depths(band_count, 0.f);
+
+    if (progress) {
+        progress->rows_done = 0;
+        progress->rows_total = rows;
+    }
+
+    pool.parallel_for(band_count, [&](size_t band) {
+        TRACE_SCOPE("back-project band");
+        const size_t first_row = band * rows_per_band;
+        const size_t last_row = std::min(first_row + rows_per_band, rows);
+
+        // With a stride the samples are gathered first so the kernel always sees contiguous runs.
+        std::vector<uint16_t> depth_scratch(stride > 1 && !metric_pixels ? columns : 0);
+        std::vector<float> metric_scratch(stride > 1 && metric_pixels ? columns : 0);
+        std::vector<uint8_t> rgb_scratch(stride > 1 ? columns * 3 : 0);
+
+        float max_depth = 0.f;
+
+        for (size_t row = first_row; row < last_row; row++) {
+            if (progress && progress->cancelled.load(std::memory_order_relaxed))
+                break;
+
+            const int v = static_cast<int>(row * stride);
+            const uint16_t* depth_row = metric_pixels ? nullptr : pixels2 + static_cast<size_t>(v) * w1;
+            const float* metric_row = metric_pixels ? metric_pixels + static_cast<size_t>(v) * w1 : nullptr;
+            const uint8_t* rgb_row = pixels1 + static_cast<size_t>(v) * w1 * 3;
+
+            if (stride > 1) {
+                for (size_t column = 0; column < columns; column++) {
+                    const size_t u = column * stride;
+                    if (metric_row)
+                        metric_scratch[column] = metric_row[u];
+                    else
+                        depth_scratch[column] = depth_row[u];
+                    std::copy_n(rgb_row + u * 3, 3, rgb_scratch.data() + column * 3);
+                }
+                depth_row = metric_row ? nullptr : depth_scratch.data();
+                metric_row = metric_row ? metric_scratch.data() : nullptr;
+                rgb_row = rgb_scratch.data();
+            }
+
+            const depth_run_t run {
+                .depth = depth_row,
+                .metric_depth = metric_row,
+                .rgb = rgb_row,
+                // Without distortion the x factors only depend on the column, so are shared by every row.
+                .x_factors = rays.x_factors.data() + (rays.separable ? 0 : row * columns),
+                .y_factors = rays.separable ? nullptr : rays.y_factors.data() + row * columns,
+                .y_factor = rays.separable ? rays.y_factors[row] : 0.f,
+                .count = columns,
+                .out = nullptr
+            };
+            if (!filter)
+                max_depth = std::max(max_depth, project_run(row * columns, run));
+            else {
+                const uint8_t* keep = filter->keep.data() + row * columns;
+                size_t first = filter->row_offsets[row];
+                for (size_t begin = 0; begin < columns;) {
+                    if (!keep[begin]) {
+                        begin++;
+                        continue;
+                    }
+                    size_t end = begin + 1;
+                    while (end < columns && keep[end])
+                        end++;
+                    max_depth = std::max(max_depth, project_run(first, slice_run(run, begin, end - begin)));
+                    first += end - begin;
+                    begin = end;
+                }
+            }
+
+            if (progress)
+                progress->rows_done.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        band_max_depths[band] = max_depth;
+    });
+
+    // Max is order independent, so the result matches the serial loop at any thread count.
+    return band_count ? *std::max_element(band_max_depths.begin(), band_max_depths.end()) : 0.f;
+}
+
+depth_cloud_result_t generate_depth_cloud(
+    const depth_images_t& images,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool,
+    generation_progress_t* progress
+) {
+    TRACE_SCOPE("generate_depth_cloud");
+
+    // Every kept sample produces exactly one vertex, so each row's slice of the output is
+    // known up front and bands of rows can be filled independently. Without the filter that
+    // is every sample.
+    std::optional<depth_filter_result_t> filter;
+    if (flying_pixel_threshold > 0.f)
+        filter = filter_flying_pixels(images, stride, flying_pixel_threshold, pool);
+
+    std::vector<vertex_t> vertices;
+    {
+        // Zero filling faults in every page of the output.
+        TRACE_SCOPE("allocate vertices");
+        vertices.resize(filter ? filter->row_offsets.back() : get_depth_cloud_size(images.width, images.height, stride));
+    }
+
+    TRACE_SCOPE("back-project");
+    const auto kernel = best_depth_kernel();
+    const auto rays = get_ray_table(images.width, images.height, stride, intrinsics, pool);
+    const auto* filter_result = filter ? &*filter : nullptr;
+    const float max_depth = back_project_rows(images, *rays, stride, filter_result, pool, progress, [&](size_t first, depth_run_t run) {
+        run.out = vertices.data() + first;
+        return back_project_run(kernel, run);
+    });
+
+    return depth_cloud_result_t { std::move(vertices), max_depth };
+}
+
+packed_depth_cloud_result_t generate_packed_depth_cloud(
+    const depth_images_t& images,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool,
+    generation_progress_t* progress
+) {
+    TRACE_SCOPE("generate_packed_depth_cloud");
+
+    std::optional<depth_filter_result_t> filter;
+    if (flying_pixel_threshold > 0.f)
+        filter = filter_flying_pixels(images, stride, flying_pixel_threshold, pool);
+
+    std::vector<packed_vertex_t> vertices;
+    {
+        TRACE_SCOPE("allocate vertices");
+        vertices.resize(filter ? filter->row_offsets.back() : get_depth_cloud_size(images.width, images.height, stride));
+    }
+
+    // Quantization needs the bounds before any point is written. Every point is
+    // depth * factor with 0 <= depth <= max_depth, so the bounds follow from max_depth and
+    // the range of the ray table's factors alone. Filtered out samples can only make them
+    // looser than they need to be.
+    float max_depth;
+    {
+        TRACE_SCOPE("find max depth");
+        max_depth = get_max_depth(images);
+    }
+    const auto rays = get_ray_table(images.width, images.height, stride, intrinsics, pool);
+
+    const auto bounds_min = glm::vec3(
+        max_depth * std::min(rays->x_min, 0.f),
+        max_depth * std::min(rays->y_min, 0.f),
+        0.f
+    );
+    const auto bounds_max = glm::vec3(
+        max_depth * std::max(rays->x_max, 0.f),
+        max_depth * std::max(rays->y_max, 0.f),
+        max_depth
+    );
+
+    auto extent = bounds_max - bounds_min;
+    // A flat axis would otherwise divide by zero.
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.f)
+            extent[axis] = 1.f;
+    }
+    const auto to_unit = glm::vec3(65535.f) / extent;
+
+    TRACE_SCOPE("back-project");
+    const auto kernel = best_depth_kernel();
+    const auto* filter_result = filter ? &*filter : nullptr;
+    const float sampled_max_depth = back_project_rows(images, *rays, stride, filter_result, pool, progress, [&](size_t first, depth_run_t run) {
+        // Projected at full precision into a per-thread run, then quantized into place.
+        thread_local std::vector<vertex_t> scratch;
+        scratch.resize(run.count);
+        run.out = scratch.data();
+        const float run_max_depth = back_project_run(kernel, run);
+
+        packed_vertex_t* out = vertices.data() + first;
+        for (size_t i = 0; i < run.count; i++) {
+            const auto unit = glm::clamp((scratch[i].position - bounds_min) * to_unit, glm::vec3(0.f), glm::vec3(65535.f));
+            const auto color = scratch[i].color * 255.f;
+
+            out[i] = packed_vertex_t {
+                .position = {
+                    static_cast<uint16_t>(unit.x + .5f),
+                    static_cast<uint16_t>(unit.y + .5f),
+                    static_cast<uint16_t>(unit.z + .5f),
+                    0
+                },
+                .color = {
+                    static_cast<uint8_t>(color.x + .5f),
+                    static_cast<uint8_t>(color.y + .5f),
+                    static_cast<uint8_t>(color.z + .5f),
+                    255
+                }
+            };
+        }
+
+        return run_max_depth;
+    });
+
+    return packed_depth_cloud_result_t {
+        .vertices = std::move(vertices),
+        .position_offset = bounds_min,
+        .position_extent = extent,
+        .max_depth = sampled_max_depth
+    };
+}
+
+std::expected<depth_cloud_result_t, std::string> generate_depth_cloud(
+    const std::filesystem::path& image_path,
+    const std::filesystem::path& depth_path,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool
+) {
+    const auto images = load_depth_images(image_path, depth_path, &pool);
+    if (!images)
+        return std::unexpected(images.error());
+
+    return generate_depth_cloud(*images, intrinsics, stride, flying_pixel_threshold, pool);
+}
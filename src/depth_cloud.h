@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mapped_file.h"
+#include "ray_table.h"
+
+class thread_pool_t;
+
+struct vertex_t {
+	glm::vec3 position;
+    glm::vec3 color;
+};
+
+struct depth_cloud_result_t {
+    std::vector<vertex_t> vertices;
+    float max_depth;
+};
+
+// Compact layout for large clouds, 12 bytes per point instead of 24. Positions are 16-bit
+// normalized within the cloud's bounds and dequantized in the vertex shader.
+struct packed_vertex_t {
+    // x, y, z and padding to keep the color 4-byte aligned.
+    uint16_t position[4];
+    // RGBA8 normalized.
+    uint8_t color[4];
+};
+
+struct packed_depth_cloud_result_t {
+    std::vector<packed_vertex_t> vertices;
+    // position = position_offset + (quantized / 65535) * position_extent
+    glm::vec3 position_offset;
+    glm::vec3 position_extent;
+    float max_depth;
+};
+
+enum class vertex_layout_t {
+    // vertex_t
+    full,
+    // packed_vertex_t
+    packed
+};
+
+// Shared with a background generation to report how far it has got and to stop it early.
+struct generation_progress_t {
+    std::atomic<size_t> rows_done = 0;
+    std::atomic<size_t> rows_total = 0;
+    // Once set, remaining rows are skipped and the result should be discarded.
+    std::atomic<bool> cancelled = false;
+};
+
+// Releases pixel buffers returned by the image decoder.
+struct image_free_t {
+    void operator()(void* pixels) const;
+};
+
+using rgb_pixels_t = std::unique_ptr<uint8_t[], image_free_t>;
+using depth_pixels_t = std::unique_ptr<uint16_t[], image_free_t>;
+using metric_pixels_t = std::unique_ptr<float[], image_free_t>;
+
+// Float depth in metres. data points into file when the samples could be used straight
+// out of the mapping, and into pixels when they had to be converted.
+struct metric_depth_t {
+    const float* data;
+    metric_pixels_t pixels;
+    mapped_file_t file;
+};
+
+// A decoded image and its matching depth map, both width * height samples.
+struct depth_images_t {
+    int width;
+    int height;
+    // Interleaved 8-bit RGB.
+    rgb_pixels_t rgb;
+    // Single channel 16-bit depth, metric scaled up by 255. Null for float depth maps.
+    depth_pixels_t depth;
+    // Set instead of depth for float depth maps.
+    metric_depth_t metric_depth;
+};
+
+// Decodes the image and depth map concurrently on the pool when one is given.
+std::expected<depth_images_t, std::string> load_depth_images(
+    const std::filesystem::path& image_path,
+    const std::filesystem::path& depth_path,
+    thread_pool_t* pool = nullptr
+);
+
+// Number of points generated from a width * height map at the given stride, before filtering.
+size_t get_depth_cloud_size(int width, int height, unsigned int stride);
+
+// Largest metric depth in the map, as generate_depth_cloud would report it.
+float get_max_depth(const depth_images_t& images);
+
+// The generate functions drop samples on depth discontinuities when flying_pixel_threshold is
+// above 0, see filter_flying_pixels. Otherwise every sample becomes a point.
+depth_cloud_result_t generate_depth_cloud(
+    const depth_images_t& images,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool,
+    generation_progress_t* progress = nullptr
+);
+
+packed_depth_cloud_result_t generate_packed_depth_cloud(
+    const depth_images_t& images,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool,
+    generation_progress_t* progress = nullptr
+);
+
+std::expected<depth_cloud_result_t, std::string> generate_depth_cloud(
+    const std::filesystem::path& image_path,
+    const std::filesystem::path& depth_path,
+    const camera_intrinsics_t& intrinsics,
+    unsigned int stride,
+    float flying_pixel_threshold,
+    thread_pool_t& pool
+);
@@ -0,0 +1,129 @@
+#include "depth_filter.h"
+
+#include <algorithm>
+#include <cfloat>
+#include "thread_pool.h"
+#include "trace.h"
+
+// 16-bit samples are compared at their raw scale, as the test is relative.
+static uint16_t depth_sample(uint16_t depth) {
+    return depth;
+}
+
+// Invalid float samples become 0, as the kernels treat them.
+static float depth_sample(float depth) {
+    return depth > 0.f && depth <= FLT_MAX ? depth : 0.f;
+}
+
+static bool keep_sample(float low, float high, float center, float threshold) {
+    return high - low <= threshold * center;
+}
+
+// Filters the sampled rows [first_row, last_row), writing each row's kept count to row_counts.
+template <typename T>
+static void filter_rows(
+    const T* depth,
+    int width,
+    int height,
+    unsigned int stride,
+    float threshold,
+    size_t first_row,
+    size_t last_row,
+    uint8_t* keep,
+    size_t* row_counts
+) {
+    const size_t columns = (width + stride - 1) / stride;
+    // Vertical min and max of every column at stride 1, where each is shared by three windows.
+    std::vector<T> column_min(stride == 1 ? width : 0);
+    std::vector<T> column_max(stride == 1 ? width : 0);
+
+    for (size_t row = first_row; row < last_row; row++) {
+        const int y = static_cast<int>(row * stride);
+        const T* above = depth + static_cast<size_t>(std::max(y - 1, 0)) * width;
+        const T* center = depth + static_cast<size_t>(y) * width;
+        const T* below = depth + static_cast<size_t>(std::min(y + 1, height - 1)) * width;
+        uint8_t* row_keep = keep + row * columns;
+        size_t kept = 0;
+
+        if (stride == 1) {
+            for (int x = 0; x < width; x++) {
+                const T a = depth_sample(above[x]);
+                const T b = depth_sample(center[x]);
+                const T c = depth_sample(below[x]);
+                column_min[x] = std::min(std::min(a, b), c);
+                column_max[x] = std::max(std::max(a, b), c);
+            }
+
+            const auto keep_window = [&](int x, int left, int right) {
+                const T low = std::min(std::min(column_min[left], column_min[x]), column_min[right]);
+                const T high = std::max(std::max(column_max[left], column_max[x]), column_max[right]);
+                return keep_sample(low, high, depth_sample(center[x]), threshold);
+            };
+
+            // The edges clamp, which the loop over the rest is kept free of so it vectorizes.
+            row_keep[0] = keep_window(0, 0, std::min(1, width - 1));
+            for (int x = 1; x < width - 1; x++)
+                row_keep[x] = keep_window(x, x - 1, x + 1);
+            if (width > 1)
+                row_keep[width - 1] = keep_window(width - 1, width - 2, width - 1);
+
+            for (int x = 0; x < width; x++)
+                kept += row_keep[x];
+        }
+        else {
+            // Windows no longer overlap much, so each reads its 3x3 pixels directly.
+            for (size_t column = 0; column < columns; column++) {
+                const int x = static_cast<int>(column * stride);
+                const int left = std::max(x - 1, 0);
+                const int right = std::min(x + 1, width - 1);
+
+                T low = depth_sample(center[x]);
+                T high = low;
+                for (const T* line : { above, center, below }) {
+                    for (const int sample_x : { left, x, right }) {
+                        const T sample = depth_sample(line[sample_x]);
+                        low = std::min(low, sample);
+                        high = std::max(high, sample);
+                    }
+                }
+
+                row_keep[column] = keep_sample(low, high, depth_sample(center[x]), threshold);
+                kept += row_keep[column];
+            }
+        }
+
+        row_counts[row] = kept;
+    }
+}
+
+depth_filter_result_t filter_flying_pixels(const depth_images_t& images, unsigned int stride, float threshold, thread_pool_t& pool) {
+    TRACE_SCOPE("filter flying pixels");
+
+    const size_t columns = (images.width + stride - 1) / stride;
+    const size_t rows = (images.height + stride - 1) / stride;
+
+    depth_filter_result_t result;
+    result.keep.resize(columns * rows);
+    result.row_offsets.resize(rows + 1);
+
+    // Same banding as back-projection.
+    const size_t band_count = std::min<size_t>(rows, pool.thread_count() * 4);
+    const size_t rows_per_band = band_count ? (rows + band_count - 1) / band_count : 0;
+
+    pool.parallel_for(band_count, [&](size_t band) {
+        const size_t first_row = band * rows_per_band;
+        const size_t last_row = std::min(first_row + rows_per_band, rows);
+
+        // Counts go one past the row, so the running sum below turns them into offsets.
+        size_t* row_counts = result.row_offsets.data() + 1;
+        if (images.metric_depth.data)
+            filter_rows(images.metric_depth.data, images.width, images.height, stride, threshold, first_row, last_row, result.keep.data(), row_counts);
+        else
+            filter_rows(images.depth.get(), images.width, images.height, stride, threshold, first_row, last_row, result.keep.data(), row_counts);
+    });
+
+    for (size_t row = 0; row < rows; row++)
+        result.row_offsets[row + 1] += result.row_offsets[row];
+
+    return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "depth_cloud.h"
+
+class thread_pool_t;
+
+// Which sampled pixels survive the flying pixel filter.
+struct depth_filter_result_t {
+    // One byte per sample, row by row, non-zero to keep it.
+    std::vector<uint8_t> keep;
+    // Index of each row's first kept sample in the filtered cloud, plus the total at the end.
+    std::vector<size_t> row_offsets;
+};
+
+// Rejects samples on depth discontinuities, where monocular depth smears points into streaks
+// between the foreground and background. A sample is dropped when the depth range of its 3x3
+// full-resolution neighbourhood is more than threshold times its own depth, so the test is
+// the same near and far. The window slides down each band of rows on the pool, converting
+// every depth row once and sharing each column's vertical min and max between the windows
+// that overlap it.
+depth_filter_result_t filter_flying_pixels(const depth_images_t& images, unsigned int stride, float threshold, thread_pool_t& pool);
@@ -0,0 +1,315 @@
+#include "depth_kernel.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DEPTH_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need the wider instruction sets enabled per function so the rest of the
+// binary still runs on older CPUs. MSVC allows the intrinsics anywhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define DEPTH_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DEPTH_KERNEL_TARGET(isa)
+#endif
+
+static_assert(sizeof(vertex_t) == 6 * sizeof(float), "Kernels write vertex_t as 6 packed floats.");
+
+namespace {
+
+constexpr float inv_255 = 1.f / 255.f;
+
+// Float depth maps can hold NaN, infinity or negative values for pixels without a depth. Those
+// become 0, which is where a 0 in a 16-bit map ends up too.
+inline float sanitize_metric_depth(float depth) {
+    return depth > 0.f && depth <= FLT_MAX ? depth : 0.f;
+}
+
+// Reference kernel, also used for the tail of the SIMD kernels. Returns the max depth in metres.
+template <bool metric>
+float back_project_scalar(const depth_run_t& run, size_t begin) {
+    uint16_t max_gray = 0;
+    float max_depth = 0.f;
+
+    for (size_t i = begin; i < run.count; i++) {
+        float depth;
+        if constexpr (metric) {
+            depth = sanitize_metric_depth(run.metric_depth[i]);
+            max_depth = std::max(max_depth, depth);
+        }
+        else {
+            const uint16_t gray = run.depth[i];
+            max_gray = std::max(max_gray, gray);
+
+            // ZoeDepth maps are metric scaled down by 255.
+            depth = static_cast<float>(gray) * inv_255;
+        }
+
+        const uint8_t* rgb = run.rgb + i * 3;
+
+        run.out[i].position = glm::vec3(depth * run.x_factors[i], depth * (run.y_factors ? run.y_factors[i] : run.y_factor), depth);
+        run.out[i].color = glm::vec3(
+            static_cast<float>(rgb[0]) * inv_255,
+            static_cast<float>(rgb[1]) * inv_255,
+            static_cast<float>(rgb[2]) * inv_255
+        );
+    }
+
+    // Scaled the same way as each sample, which is monotonic.
+    return metric ? max_depth : static_cast<float>(max_gray) * inv_255;
+}
+
+#if DEPTH_KERNEL_X86
+
+// Shuffles 24 bytes of interleaved RGB (loaded as bytes 0-15 and 8-23) into
+// R0-3 G0-3 B0-3 and R4-7 G4-7 B4-7 respectively.
+DEPTH_KERNEL_TARGET("sse4.1")
+inline void deinterleave_rgb8(const uint8_t* rgb, __m128i& rg, __m128i& b) {
+    const __m128i lo_mask = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+    const __m128i hi_mask = _mm_setr_epi8(4, 7, 10, 13, 5, 8, 11, 14, 6, 9, 12, 15, -1, -1, -1, -1);
+
+    const __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb)), lo_mask);
+    const __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 8)), hi_mask);
+
+    // R0-7 G0-7, and B0-7 in the low half.
+    rg = _mm_unpacklo_epi32(lo, hi);
+    b = _mm_unpackhi_epi32(lo, hi);
+}
+
+DEPTH_KERNEL_TARGET("sse4.1")
+inline uint16_t horizontal_max_epu16(__m128i v) {
+    // minpos only exists for the minimum, so find it on the inverted values.
+    const __m128i inverted = _mm_xor_si128(v, _mm_set1_epi16(-1));
+    return static_cast<uint16_t>(~_mm_extract_epi16(_mm_minpos_epu16(inverted), 0));
+}
+
+DEPTH_KERNEL_TARGET("sse4.1")
+inline float horizontal_max_ps(__m128 v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+// The SIMD version of sanitize_metric_depth. The ordered compares are false for NaN.
+DEPTH_KERNEL_TARGET("sse4.1")
+inline __m128 sanitize_metric_depth_sse(__m128 depth) {
+    const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(depth, _mm_setzero_ps()), _mm_cmple_ps(depth, _mm_set1_ps(FLT_MAX)));
+    return _mm_and_ps(depth, valid);
+}
+
+DEPTH_KERNEL_TARGET("avx2")
+inline __m256 sanitize_metric_depth_avx(__m256 depth) {
+    const __m256 valid = _mm256_and_ps(
+        _mm256_cmp_ps(depth, _mm256_setzero_ps(), _CMP_GT_OQ),
+        _mm256_cmp_ps(depth, _mm256_set1_ps(FLT_MAX), _CMP_LE_OQ)
+    );
+    return _mm256_and_ps(depth, valid);
+}
+
+// Interleaves 4 samples of x, y, z, r, g, b into 24 consecutive floats.
+DEPTH_KERNEL_TARGET("sse4.1")
+inline void store_vertices_sse(float* out, __m128 x, __m128 y, __m128 z, __m128 r, __m128 g, __m128 b) {
+    const __m128 xy_lo = _mm_unpacklo_ps(x, y);
+    const __m128 xy_hi = _mm_unpackhi_ps(x, y);
+    const __m128 zr_lo = _mm_unpacklo_ps(z, r);
+    const __m128 zr_hi = _mm_unpackhi_ps(z, r);
+    const __m128 gb_lo = _mm_unpacklo_ps(g, b);
+    const __m128 gb_hi = _mm_unpackhi_ps(g, b);
+
+    _mm_storeu_ps(out, _mm_shuffle_ps(xy_lo, zr_lo, _MM_SHUFFLE(1, 0, 1, 0)));
+    _mm_storeu_ps(out + 4, _mm_shuffle_ps(gb_lo, xy_lo, _MM_SHUFFLE(3, 2, 1, 0)));
+    _mm_storeu_ps(out + 8, _mm_shuffle_ps(zr_lo, gb_lo, _MM_SHUFFLE(3, 2, 3, 2)));
+    _mm_storeu_ps(out + 12, _mm_shuffle_ps(xy_hi, zr_hi, _MM_SHUFFLE(1, 0, 1, 0)));
+    _mm_storeu_ps(out + 16, _mm_shuffle_ps(gb_hi, xy_hi, _MM_SHUFFLE(3, 2, 1, 0)));
+    _mm_storeu_ps(out + 20, _mm_shuffle_ps(zr_hi, gb_hi, _MM_SHUFFLE(3, 2, 3, 2)));
+}
+
+template <bool metric>
+DEPTH_KERNEL_TARGET("sse4.1")
+float back_project_sse41(const depth_run_t& run) {
+    const __m128 inv = _mm_set1_ps(inv_255);
+    const __m128 y_factor = _mm_set1_ps(run.y_factor);
+    __m128i max_gray = _mm_setzero_si128();
+    __m128 max_depth = _mm_setzero_ps();
+    float* out = reinterpret_cast<float*>(run.out);
+
+    size_t i = 0;
+    for (; i + 8 <= run.count; i += 8, out += 48) {
+        __m128i gray = _mm_setzero_si128();
+        if constexpr (!metric) {
+            gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(run.depth + i));
+            max_gray = _mm_max_epu16(max_gray, gray);
+        }
+
+        __m128i rg, b;
+        deinterleave_rgb8(run.rgb + i * 3, rg, b);
+
+        // Two halves of 4 samples each.
+        for (int half = 0; half < 2; half++) {
+            const __m128i gray_half = half ? _mm_srli_si128(gray, 8) : gray;
+            const __m128i r_half = half ? _mm_srli_si128(rg, 4) : rg;
+            const __m128i g_half = half ? _mm_srli_si128(rg, 12) : _mm_srli_si128(rg, 8);
+            const __m128i b_half = half ? _mm_srli_si128(b, 4) : b;
+
+            __m128 depth;
+            if constexpr (metric) {
+                depth = sanitize_metric_depth_sse(_mm_loadu_ps(run.metric_depth + i + half * 4));
+                max_depth = _mm_max_ps(max_depth, depth);
+            }
+            else
+                depth = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(gray_half)), inv);
+            const __m128 x = _mm_mul_ps(depth, _mm_loadu_ps(run.x_factors + i + half * 4));
+            const __m128 y = _mm_mul_ps(depth, run.y_factors ? _mm_loadu_ps(run.y_factors + i + half * 4) : y_factor);
+
+            store_vertices_sse(
+                out + half * 24,
+                x, y, depth,
+                _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(r_half)), inv),
+                _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(g_half)), inv),
+                _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(b_half)), inv)
+            );
+        }
+    }
+
+    const float simd_max = metric ? horizontal_max_ps(max_depth) : static_cast<float>(horizontal_max_epu16(max_gray)) * inv_255;
+    return std::max(simd_max, back_project_scalar<metric>(run, i));
+}
+
+template <bool metric>
+DEPTH_KERNEL_TARGET("avx2")
+float back_project_avx2(const depth_run_t& run) {
+    const __m256 inv = _mm256_set1_ps(inv_255);
+    const __m256 y_factor = _mm256_set1_ps(run.y_factor);
+    __m128i max_gray = _mm_setzero_si128();
+    __m256 max_depth = _mm256_setzero_ps();
+    float* out = reinterpret_cast<float*>(run.out);
+
+    size_t i = 0;
+    for (; i + 8 <= run.count; i += 8, out += 48) {
+        __m256 depth;
+        if constexpr (metric) {
+            depth = sanitize_metric_depth_avx(_mm256_loadu_ps(run.metric_depth + i));
+            max_depth = _mm256_max_ps(max_depth, depth);
+        }
+        else {
+            const __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(run.depth + i));
+            max_gray = _mm_max_epu16(max_gray, gray);
+            depth = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(gray)), inv);
+        }
+
+        __m128i rg, b8;
+        deinterleave_rgb8(run.rgb + i * 3, rg, b8);
+
+        const __m256 x = _mm256_mul_ps(depth, _mm256_loadu_ps(run.x_factors + i));
+        const __m256 y = _mm256_mul_ps(depth, run.y_factors ? _mm256_loadu_ps(run.y_factors + i) : y_factor);
+        const __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(rg)), inv);
+        const __m256 g = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(rg, 8))), inv);
+        const __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b8)), inv);
+
+        // Same interleave as the SSE path, with samples 0-3 in the low lanes and 4-7 in the high.
+        const __m256 xy_lo = _mm256_unpacklo_ps(x, y);
+        const __m256 xy_hi = _mm256_unpackhi_ps(x, y);
+        const __m256 zr_lo = _mm256_unpacklo_ps(depth, r);
+        const __m256 zr_hi = _mm256_unpackhi_ps(depth, r);
+        const __m256 gb_lo = _mm256_unpacklo_ps(g, b);
+        const __m256 gb_hi = _mm256_unpackhi_ps(g, b);
+
+        const __m256 o0 = _mm256_shuffle_ps(xy_lo, zr_lo, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 o1 = _mm256_shuffle_ps(gb_lo, xy_lo, _MM_SHUFFLE(3, 2, 1, 0));
+        const __m256 o2 = _mm256_shuffle_ps(zr_lo, gb_lo, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 o3 = _mm256_shuffle_ps(xy_hi, zr_hi, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 o4 = _mm256_shuffle_ps(gb_hi, xy_hi, _MM_SHUFFLE(3, 2, 1, 0));
+        const __m256 o5 = _mm256_shuffle_ps(zr_hi, gb_hi, _MM_SHUFFLE(3, 2, 3, 2));
+
+        _mm256_storeu_ps(out, _mm256_permute2f128_ps(o0, o1, 0x20));
+        _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(o2, o3, 0x20));
+        _mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(o4, o5, 0x20));
+        _mm256_storeu_ps(out + 24, _mm256_permute2f128_ps(o0, o1, 0x31));
+        _mm256_storeu_ps(out + 32, _mm256_permute2f128_ps(o2, o3, 0x31));
+        _mm256_storeu_ps(out + 40, _mm256_permute2f128_ps(o4, o5, 0x31));
+    }
+
+    const float simd_max = metric
+        ? horizontal_max_ps(_mm_max_ps(_mm256_castps256_ps128(max_depth), _mm256_extractf128_ps(max_depth, 1)))
+        : static_cast<float>(horizontal_max_epu16(max_gray)) * inv_255;
+    return std::max(simd_max, back_project_scalar<metric>(run, i));
+}
+
+depth_kernel_t detect_depth_kernel() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse41 = info[2] & (1 << 19);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+
+    bool avx2 = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        // The OS must also save the YMM registers on context switch.
+        avx2 = (info[1] & (1 << 5)) && osxsave && avx && (_xgetbv(0) & 6) == 6;
+    }
+
+    if (avx2)
+        return depth_kernel_t::avx2;
+    if (sse41)
+        return depth_kernel_t::sse41;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return depth_kernel_t::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return depth_kernel_t::sse41;
+#endif
+    return depth_kernel_t::scalar;
+}
+
+#else
+
+depth_kernel_t detect_depth_kernel() {
+    return depth_kernel_t::scalar;
+}
+
+#endif
+
+}
+
+depth_kernel_t best_depth_kernel() {
+    static const depth_kernel_t kernel = detect_depth_kernel();
+    return kernel;
+}
+
+bool depth_kernel_supported(depth_kernel_t kernel) {
+    return static_cast<int>(kernel) <= static_cast<int>(best_depth_kernel());
+}
+
+const char* depth_kernel_name(depth_kernel_t kernel) {
+    switch (kernel) {
+    case depth_kernel_t::avx2:
+        return "AVX2";
+    case depth_kernel_t::sse41:
+        return "SSE4.1";
+    default:
+        return "Scalar";
+    }
+}
+
+float back_project_run(depth_kernel_t kernel, const depth_run_t& run) {
+    const bool metric = run.metric_depth != nullptr;
+#if DEPTH_KERNEL_X86
+    if (kernel == depth_kernel_t::avx2 && depth_kernel_supported(kernel))
+        return metric ? back_project_avx2<true>(run) : back_project_avx2<false>(run);
+    if (kernel == depth_kernel_t::sse41 && depth_kernel_supported(kernel))
+        return metric ? back_project_sse41<true>(run) : back_project_sse41<false>(run);
+#endif
+    return metric ? back_project_scalar<true>(run, 0) : back_project_scalar<false>(run, 0);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "depth_cloud.h"
+
+enum class depth_kernel_t {
+    scalar,
+    sse41,
+    avx2
+};
+
+// A run of contiguous samples from one row of the depth map and image.
+struct depth_run_t {
+    // 16-bit depth, metric scaled up by 255.
+    const uint16_t* depth;
+    // Depth in metres, read instead of depth when set.
+    const float* metric_depth;
+    // Interleaved RGB, 3 bytes per sample.
+    const uint8_t* rgb;
+    // Per-sample x of the ray through each pixel, from the ray table.
+    const float* x_factors;
+    // Per-sample y of the ray, for lenses with distortion. Null when y is the same along the
+    // row, which y_factor then holds.
+    const float* y_factors;
+    float y_factor;
+    size_t count;
+    vertex_t* out;
+};
+
+// Widest kernel the CPU supports, detected once.
+depth_kernel_t best_depth_kernel();
+bool depth_kernel_supported(depth_kernel_t kernel);
+const char* depth_kernel_name(depth_kernel_t kernel);
+
+// Writes run.count vertices to run.out and returns the largest depth seen, in metres.
+// Every kernel produces bit-identical output.
+float back_project_run(depth_kernel_t kernel, const depth_run_t& run);
@@ -0,0 +1,239 @@
+#include "float_depth.h"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Layout of the samples in a float depth file.
+struct sample_layout_t {
+    size_t offset;
+    bool half;
+    bool big_endian;
+    // Column major, as NPY arrays with fortran_order are.
+    bool column_major;
+    // Last row first, as PFM stores them.
+    bool bottom_up;
+};
+
+float half_to_float(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else {
+        // Subnormal halves are normal floats, so shift the mantissa up to its implicit bit.
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    return std::bit_cast<float>(bits);
+}
+
+float read_sample(const std::byte* data, size_t index, const sample_layout_t& layout) {
+    if (layout.half) {
+        uint16_t bits;
+        std::memcpy(&bits, data + index * sizeof(bits), sizeof(bits));
+        return half_to_float(layout.big_endian ? std::byteswap(bits) : bits);
+    }
+
+    uint32_t bits;
+    std::memcpy(&bits, data + index * sizeof(bits), sizeof(bits));
+    return std::bit_cast<float>(layout.big_endian ? std::byteswap(bits) : bits);
+}
+
+std::expected<float_depth_image_t, std::string> make_depth_image(
+    mapped_file_t file,
+    int width,
+    int height,
+    const sample_layout_t& layout,
+    const std::filesystem::path& path
+) {
+    static_assert(std::endian::native == std::endian::little, "Float depth maps are only used in place on little endian hosts.");
+
+    const size_t count = static_cast<size_t>(width) * height;
+    const size_t sample_size = layout.half ? 2 : 4;
+    const auto bytes = file.bytes();
+    if (width <= 0 || height <= 0 || layout.offset > bytes.size() || (bytes.size() - layout.offset) / sample_size < count)
+        return std::unexpected(path.string() + " is truncated or has an invalid size.");
+
+    const std::byte* data = bytes.data() + layout.offset;
+
+    const bool in_place = !layout.half && !layout.big_endian && !layout.column_major && !layout.bottom_up
+        && reinterpret_cast<uintptr_t>(data) % alignof(float) == 0;
+    if (in_place) {
+        return float_depth_image_t {
+            .width = width,
+            .height = height,
+            .depth = metric_depth_t { reinterpret_cast<const float*>(data), nullptr, std::move(file) }
+        };
+    }
+
+    metric_pixels_t pixels(static_cast<float*>(std::malloc(count * sizeof(float))));
+    if (!pixels)
+        return std::unexpected("Out of memory reading " + path.string() + ".");
+
+    for (size_t row = 0; row < static_cast<size_t>(height); row++) {
+        const size_t source_row = layout.bottom_up ? height - 1 - row : row;
+        float* out = pixels.get() + row * width;
+        for (size_t column = 0; column < static_cast<size_t>(width); column++) {
+            const size_t index = layout.column_major ? column * height + source_row : source_row * width + column;
+            out[column] = read_sample(data, index, layout);
+        }
+    }
+
+    const float* converted = pixels.get();
+    return float_depth_image_t {
+        .width = width,
+        .height = height,
+        .depth = metric_depth_t { converted, std::move(pixels), mapped_file_t() }
+    };
+}
+
+// Value of a key in the Python dict literal of an NPY header, up to the next top level comma.
+std::string_view npy_header_value(std::string_view header, std::string_view key) {
+    const auto key_at = header.find("'" + std::string(key) + "'");
+    if (key_at == std::string_view::npos)
+        return {};
+
+    auto value = header.substr(header.find(':', key_at) + 1);
+    value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+
+    // The shape tuple contains commas of its own.
+    const auto end = value.starts_with('(') ? value.find(')') + 1 : value.find_first_of(",}");
+    return value.substr(0, end);
+}
+
+std::expected<float_depth_image_t, std::string> read_npy(mapped_file_t file, const std::filesystem::path& path) {
+    const auto bytes = file.bytes();
+    const auto chars = reinterpret_cast<const char*>(bytes.data());
+
+    if (bytes.size() < 10 || std::memcmp(chars, "\x93NUMPY", 6) != 0)
+        return std::unexpected(path.string() + " is not an NPY file.");
+
+    // Version 1 has a 16-bit header length, later versions a 32-bit one.
+    const auto major = static_cast<uint8_t>(chars[6]);
+    size_t header_length = 0;
+    size_t header_start = 0;
+    if (major == 1) {
+        header_length = static_cast<uint8_t>(chars[8]) | static_cast<size_t>(static_cast<uint8_t>(chars[9])) << 8;
+        header_start = 10;
+    }
+    else {
+        if (bytes.size() < 12)
+            return std::unexpected(path.string() + " is truncated.");
+        for (int i = 0; i < 4; i++)
+            header_length |= static_cast<size_t>(static_cast<uint8_t>(chars[8 + i])) << (8 * i);
+        header_start = 12;
+    }
+
+    if (header_start + header_length > bytes.size())
+        return std::unexpected(path.string() + " is truncated.");
+
+    const std::string_view header(chars + header_start, header_length);
+    const auto descr = npy_header_value(header, "descr");
+    const auto fortran_order = npy_header_value(header, "fortran_order");
+    const auto shape = npy_header_value(header, "shape");
+
+    // Byte order, then kind and size, such as '<f4'. '|' and '=' both mean native here.
+    if (descr.size() != 5 || descr[2] != 'f' || (descr[3] != '4' && descr[3] != '2'))
+        return std::unexpected(path.string() + " holds " + std::string(descr) + ", only float32 and float16 are supported.");
+
+    // Axes of size 1 are dropped, which leaves (height, width).
+    std::vector<size_t> dimensions;
+    for (size_t i = 0; i < shape.size();) {
+        if (shape[i] < '0' || shape[i] > '9') {
+            i++;
+            continue;
+        }
+        size_t dimension = 0;
+        for (; i < shape.size() && shape[i] >= '0' && shape[i] <= '9'; i++)
+            dimension = dimension * 10 + static_cast<size_t>(shape[i] - '0');
+        if (dimension != 1)
+            dimensions.push_back(dimension);
+    }
+    if (dimensions.size() > 2)
+        return std::unexpected(path.string() + " has shape " + std::string(shape) + ", a single channel 2D array is expected.");
+    while (dimensions.size() < 2)
+        dimensions.insert(dimensions.begin(), 1);
+
+    const sample_layout_t layout {
+        .offset = header_start + header_length,
+        .half = descr[3] == '2',
+        .big_endian = descr[1] == '>',
+        .column_major = fortran_order.starts_with("True"),
+        .bottom_up = false
+    };
+    return make_depth_image(std::move(file), static_cast<int>(dimensions[1]), static_cast<int>(dimensions[0]), layout, path);
+}
+
+std::expected<float_depth_image_t, std::string> read_pfm(mapped_file_t file, const std::filesystem::path& path) {
+    const auto bytes = file.bytes();
+    const std::string_view text(reinterpret_cast<const char*>(bytes.data()), std::min<size_t>(bytes.size(), 256));
+
+    // Type, width, height and scale, separated by whitespace, with a single whitespace
+    // character between the scale and the samples.
+    std::string tokens[4];
+    size_t position = 0;
+    for (auto& token : tokens) {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position])))
+            position++;
+        while (position < text.size() && !std::isspace(static_cast<unsigned char>(text[position])))
+            token += text[position++];
+    }
+    position++;
+
+    if (tokens[0] == "PF")
+        return std::unexpected(path.string() + " is a color PFM, a single channel one is expected.");
+    if (tokens[0] != "Pf" || tokens[3].empty())
+        return std::unexpected(path.string() + " is not a PFM file.");
+
+    // A negative scale means little endian samples.
+    const sample_layout_t layout {
+        .offset = position,
+        .half = false,
+        .big_endian = std::atof(tokens[3].c_str()) > 0.0,
+        .column_major = false,
+        .bottom_up = true
+    };
+    return make_depth_image(std::move(file), std::atoi(tokens[1].c_str()), std::atoi(tokens[2].c_str()), layout, path);
+}
+
+}
+
+static std::string get_lowercase_extension(const std::filesystem::path& path) {
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+}
+
+bool is_float_depth_path(const std::filesystem::path& path) {
+    const auto extension = get_lowercase_extension(path);
+    return extension == ".npy" || extension == ".pfm";
+}
+
+std::expected<float_depth_image_t, std::string> read_float_depth(const std::filesystem::path& path) {
+    auto file = mapped_file_t::open(path);
+    if (!file)
+        return std::unexpected(file.error());
+
+    if (get_lowercase_extension(path) == ".npy")
+        return read_npy(std::move(*file), path);
+    return read_pfm(std::move(*file), path);
+}
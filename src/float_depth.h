@@ -0,0 +1,20 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <string>
+#include "depth_cloud.h"
+
+struct float_depth_image_t {
+    int width;
+    int height;
+    metric_depth_t depth;
+};
+
+// True for the float depth formats read_float_depth handles, going by the extension.
+bool is_float_depth_path(const std::filesystem::path& path);
+
+// Reads a metric depth map from a .npy array of float32 or float16, shaped (height, width)
+// give or take axes of size 1, or from a single channel .pfm. Little endian float32 arrays
+// in C order are used straight out of the mapped file, anything else is converted once.
+std::expected<float_depth_image_t, std::string> read_float_depth(const std::filesystem::path& path);
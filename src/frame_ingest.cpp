@@ -0,0 +1,350 @@
+#include "frame_ingest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static constexpr char ingest_magic[8] = "ZPFRAME";
+static constexpr uint32_t ingest_version = 1;
+// Larger frames are assumed to be a desynced stream rather than a 32K image.
+static constexpr uint32_t max_ingest_dimension = 32768;
+// How often blocked socket calls check whether the listener is stopping.
+static constexpr int poll_interval_ms = 100;
+
+#ifdef _WIN32
+
+using native_socket_t = SOCKET;
+// Writing to a disconnected socket only fails on Windows, there is no SIGPIPE to suppress.
+static constexpr int send_flags = 0;
+
+static bool init_sockets() {
+    static const bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return initialized;
+}
+
+static void close_socket(intptr_t socket) {
+    closesocket(static_cast<native_socket_t>(socket));
+}
+
+static int poll_socket(intptr_t socket, short events, int timeout_ms) {
+    WSAPOLLFD fd = { static_cast<native_socket_t>(socket), events, 0 };
+    return WSAPoll(&fd, 1, timeout_ms);
+}
+
+#else
+
+using native_socket_t = int;
+static constexpr int send_flags = MSG_NOSIGNAL;
+
+static bool init_sockets() {
+    return true;
+}
+
+static void close_socket(intptr_t socket) {
+    ::close(static_cast<native_socket_t>(socket));
+}
+
+static int poll_socket(intptr_t socket, short events, int timeout_ms) {
+    pollfd fd = { static_cast<native_socket_t>(socket), events, 0 };
+    return poll(&fd, 1, timeout_ms);
+}
+
+#endif
+
+static std::expected<sockaddr_un, std::string> get_socket_address(const std::filesystem::path& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+
+    const auto path_str = path.string();
+    if (path_str.empty() || path_str.size() >= sizeof(address.sun_path))
+        return std::unexpected("Socket path " + path_str + " is empty or too long.");
+
+    std::memcpy(address.sun_path, path_str.c_str(), path_str.size() + 1);
+    return address;
+}
+
+// Fills data from the socket, waking up regularly to check stopping. Returns false if the
+// peer disconnected, the socket failed, or the listener is stopping.
+static bool receive_all(intptr_t socket, void* data, size_t size, const std::atomic<bool>& stopping) {
+    auto bytes = static_cast<char*>(data);
+
+    while (size > 0) {
+        if (stopping)
+            return false;
+
+        const int ready = poll_socket(socket, POLLIN, poll_interval_ms);
+        if (ready < 0)
+            return false;
+        if (ready == 0)
+            continue;
+
+        // Stay well within the int sizes recv takes on Windows.
+        const auto chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+        const auto received = recv(static_cast<native_socket_t>(socket), bytes, chunk, 0);
+        if (received <= 0)
+            return false;
+
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
+
+static bool send_all(intptr_t socket, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        const auto chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+        const auto sent = send(static_cast<native_socket_t>(socket), bytes, chunk, send_flags);
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+std::expected<std::unique_ptr<frame_listener_t>, std::string> frame_listener_t::listen(
+    const std::filesystem::path& path,
+    std::function<void()> on_frame
+) {
+    if (!init_sockets())
+        return std::unexpected(std::string("Failed to initialize sockets."));
+
+    const auto address = get_socket_address(path);
+    if (!address)
+        return std::unexpected(address.error());
+
+    // A previous run that didn't shut down cleanly leaves its socket file behind. Anything
+    // else at the path is left alone, as it is more likely a typo than ours to replace.
+    std::error_code error;
+    if (std::filesystem::is_socket(path, error))
+        std::filesystem::remove(path, error);
+    else if (std::filesystem::exists(path, error))
+        return std::unexpected(path.string() + " exists and is not a socket.");
+
+    const auto listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_socket == static_cast<native_socket_t>(-1))
+        return std::unexpected("Failed to create a socket for " + path.string() + ".");
+
+    if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&*address), sizeof(*address)) != 0
+        || ::listen(listen_socket, 1) != 0) {
+        close_socket(static_cast<intptr_t>(listen_socket));
+        return std::unexpected("Failed to listen on " + path.string() + ".");
+    }
+
+    // Not make_unique, as the constructor is private.
+    auto listener = std::unique_ptr<frame_listener_t>(new frame_listener_t());
+    listener->socket_path = path;
+    listener->listen_socket = static_cast<intptr_t>(listen_socket);
+    listener->on_frame = std::move(on_frame);
+    // Receiving blocks for as long as a producer is connected, so it gets its own thread
+    // rather than tying up a pool worker.
+    listener->thread = std::thread(&frame_listener_t::run, listener.get());
+    return listener;
+}
+
+frame_listener_t::~frame_listener_t() {
+    stopping = true;
+    if (thread.joinable())
+        thread.join();
+
+    close_socket(listen_socket);
+    std::error_code error;
+    std::filesystem::remove(socket_path, error);
+}
+
+void frame_listener_t::run() {
+    while (!stopping) {
+        if (poll_socket(listen_socket, POLLIN, poll_interval_ms) <= 0)
+            continue;
+
+        const auto client = accept(static_cast<native_socket_t>(listen_socket), nullptr, nullptr);
+        if (client == static_cast<native_socket_t>(-1))
+            continue;
+
+        {
+            std::lock_guard lock(mutex);
+            frame_stats.connected = true;
+        }
+
+        receive_frames(static_cast<intptr_t>(client));
+        close_socket(static_cast<intptr_t>(client));
+
+        std::lock_guard lock(mutex);
+        frame_stats.connected = false;
+    }
+}
+
+void frame_listener_t::receive_frames(intptr_t client) {
+    const auto fail = [&](std::string message) {
+        std::lock_guard lock(mutex);
+        error_message = std::move(message);
+    };
+
+    // Where the producer's sequence should be next, to spot the frames it skipped.
+    uint32_t next_sequence = 0;
+    for (;;) {
+        ingest_frame_header_t header;
+        if (!receive_all(client, &header, sizeof(header), stopping))
+            return;
+
+        if (std::memcmp(header.magic, ingest_magic, sizeof(ingest_magic)) != 0 || header.version != ingest_version)
+            return fail("Producer sent an unrecognized frame header.");
+        if (header.width == 0 || header.height == 0 || header.width > max_ingest_dimension || header.height > max_ingest_dimension)
+            return fail("Producer sent a frame of " + std::to_string(header.width) + "x" + std::to_string(header.height) + ".");
+        if (header.color_format != ingest_color_format_t::rgb8)
+            return fail("Producer sent an unsupported color format.");
+        if (header.depth_format != ingest_depth_format_t::uint16 && header.depth_format != ingest_depth_format_t::float32)
+            return fail("Producer sent an unsupported depth format.");
+
+        const size_t pixel_count = static_cast<size_t>(header.width) * header.height;
+        const bool metric = header.depth_format == ingest_depth_format_t::float32;
+
+        // The pixels land straight in the buffers the cloud is generated from.
+        auto images = std::make_shared<depth_images_t>();
+        images->width = static_cast<int>(header.width);
+        images->height = static_cast<int>(header.height);
+        images->rgb.reset(static_cast<uint8_t*>(std::malloc(pixel_count * 3)));
+        if (metric) {
+            images->metric_depth.pixels.reset(static_cast<float*>(std::malloc(pixel_count * sizeof(float))));
+            images->metric_depth.data = images->metric_depth.pixels.get();
+        }
+        else
+            images->depth.reset(static_cast<uint16_t*>(std::malloc(pixel_count * sizeof(uint16_t))));
+
+        if (!images->rgb || (metric ? !images->metric_depth.pixels : !images->depth))
+            return fail("Failed to allocate a " + std::to_string(header.width) + "x" + std::to_string(header.height) + " frame.");
+
+        void* depth = metric ? static_cast<void*>(images->metric_depth.pixels.get()) : static_cast<void*>(images->depth.get());
+        if (!receive_all(client, images->rgb.get(), pixel_count * 3, stopping)
+            || !receive_all(client, depth, pixel_count * (metric ? sizeof(float) : sizeof(uint16_t)), stopping))
+            return;
+
+        {
+            std::lock_guard lock(mutex);
+            if (pending)
+                frame_stats.dropped++;
+            frame_stats.received++;
+            // Wraps like the counter, and a sequence going backwards isn't a gap.
+            const uint32_t gap = header.sequence - next_sequence;
+            if (gap < std::numeric_limits<uint32_t>::max() / 2)
+                frame_stats.skipped += gap;
+            next_sequence = header.sequence + 1;
+            pending = ingest_frame_t {
+                .images = std::move(images),
+                .fx = header.fx,
+                .fy = header.fy,
+                .cx = header.cx,
+                .cy = header.cy
+            };
+        }
+
+        if (on_frame)
+            on_frame();
+    }
+}
+
+std::optional<ingest_frame_t> frame_listener_t::take_frame() {
+    std::lock_guard lock(mutex);
+    return std::exchange(pending, std::nullopt);
+}
+
+ingest_stats_t frame_listener_t::stats() const {
+    std::lock_guard lock(mutex);
+    return frame_stats;
+}
+
+std::string frame_listener_t::last_error() const {
+    std::lock_guard lock(mutex);
+    return error_message;
+}
+
+frame_sender_t::~frame_sender_t() {
+    close();
+}
+
+frame_sender_t::frame_sender_t(frame_sender_t&& other) noexcept {
+    *this = std::move(other);
+}
+
+frame_sender_t& frame_sender_t::operator=(frame_sender_t&& other) noexcept {
+    if (this != &other) {
+        close();
+        connection = std::exchange(other.connection, -1);
+        next_sequence = std::exchange(other.next_sequence, 0);
+    }
+    return *this;
+}
+
+std::expected<frame_sender_t, std::string> frame_sender_t::connect(const std::filesystem::path& path) {
+    if (!init_sockets())
+        return std::unexpected(std::string("Failed to initialize sockets."));
+
+    const auto address = get_socket_address(path);
+    if (!address)
+        return std::unexpected(address.error());
+
+    const auto connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection == static_cast<native_socket_t>(-1))
+        return std::unexpected("Failed to create a socket for " + path.string() + ".");
+
+    frame_sender_t sender;
+    sender.connection = static_cast<intptr_t>(connection);
+    if (::connect(connection, reinterpret_cast<const sockaddr*>(&*address), sizeof(*address)) != 0)
+        return std::unexpected("Failed to connect to " + path.string() + ".");
+
+    return sender;
+}
+
+std::expected<void, std::string> frame_sender_t::send(const depth_images_t& images, float fx, float fy, float cx, float cy) {
+    const bool metric = images.metric_depth.data != nullptr;
+    const size_t pixel_count = static_cast<size_t>(images.width) * images.height;
+
+    ingest_frame_header_t header = {};
+    std::memcpy(header.magic, ingest_magic, sizeof(ingest_magic));
+    header.version = ingest_version;
+    header.width = static_cast<uint32_t>(images.width);
+    header.height = static_cast<uint32_t>(images.height);
+    header.color_format = ingest_color_format_t::rgb8;
+    header.depth_format = metric ? ingest_depth_format_t::float32 : ingest_depth_format_t::uint16;
+    header.fx = fx;
+    header.fy = fy;
+    header.cx = cx;
+    header.cy = cy;
+    header.sequence = next_sequence++;
+
+    const void* depth = metric ? static_cast<const void*>(images.metric_depth.data) : static_cast<const void*>(images.depth.get());
+    if (!send_all(connection, &header, sizeof(header))
+        || !send_all(connection, images.rgb.get(), pixel_count * 3)
+        || !send_all(connection, depth, pixel_count * (metric ? sizeof(float) : sizeof(uint16_t))))
+        return std::unexpected(std::string("The listener disconnected."));
+
+    return {};
+}
+
+void frame_sender_t::close() {
+    if (connection != -1)
+        close_socket(connection);
+    connection = -1;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include "depth_cloud.h"
+
+// Frames arrive over a local Unix domain socket as this header, followed by the color pixels
+// and then the depth pixels, both as tightly packed rows from the top. Fields are in the
+// sender's byte order, as both ends run on the same machine.
+enum class ingest_color_format_t : uint32_t {
+    rgb8
+};
+
+enum class ingest_depth_format_t : uint32_t {
+    // ZoeDepth's 16-bit encoding, metric scaled up by 255.
+    uint16,
+    // Metres.
+    float32
+};
+
+struct ingest_frame_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    ingest_color_format_t color_format;
+    ingest_depth_format_t depth_format;
+    // Pinhole intrinsics, in pixels.
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    // Counts up with every frame the producer sends, starting from 0 on each connection, so
+    // gaps show frames it skipped. Counted into ingest_stats_t::skipped.
+    uint32_t sequence;
+};
+
+struct ingest_frame_t {
+    std::shared_ptr<const depth_images_t> images;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+};
+
+struct ingest_stats_t {
+    size_t received;
+    // Frames replaced by a newer one before they were taken.
+    size_t dropped;
+    // Frames the producer skipped before sending, from gaps in the header sequence.
+    size_t skipped;
+    bool connected;
+};
+
+// Accepts one producer at a time on a Unix domain socket and keeps the newest frame it sent.
+// Frames are received on a thread of their own, straight into the buffers they are generated
+// from, so nothing touches the disk.
+class frame_listener_t {
+public:
+    // Replaces a stale socket file at path. on_frame is called from the listener thread after
+    // each frame arrives.
+    static std::expected<std::unique_ptr<frame_listener_t>, std::string> listen(
+        const std::filesystem::path& path,
+        std::function<void()> on_frame
+    );
+
+    ~frame_listener_t();
+
+    frame_listener_t(const frame_listener_t&) = delete;
+    frame_listener_t& operator=(const frame_listener_t&) = delete;
+
+    // Takes the newest frame received since the last call, if any.
+    std::optional<ingest_frame_t> take_frame();
+
+    ingest_stats_t stats() const;
+    // Why the last producer was disconnected, if it sent something invalid.
+    std::string last_error() const;
+    const std::filesystem::path& path() const { return socket_path; }
+
+private:
+    frame_listener_t() = default;
+
+    void run();
+    // Receives frames until the producer disconnects or sends something invalid.
+    void receive_frames(intptr_t client);
+
+    std::filesystem::path socket_path;
+    intptr_t listen_socket = -1;
+    std::function<void()> on_frame;
+    std::atomic<bool> stopping = false;
+    std::thread thread;
+
+    mutable std::mutex mutex;
+    std::optional<ingest_frame_t> pending;
+    ingest_stats_t frame_stats = {};
+    std::string error_message;
+};
+
+// Producer side of the socket, used by tools/frame_replay.
+class frame_sender_t {
+public:
+    frame_sender_t() = default;
+    ~frame_sender_t();
+
+    frame_sender_t(frame_sender_t&& other) noexcept;
+    frame_sender_t& operator=(frame_sender_t&& other) noexcept;
+    frame_sender_t(const frame_sender_t&) = delete;
+    frame_sender_t& operator=(const frame_sender_t&) = delete;
+
+    static std::expected<frame_sender_t, std::string> connect(const std::filesystem::path& path);
+
+    // Sends float depth maps as float32 and everything else as uint16.
+    std::expected<void, std::string> send(const depth_images_t& images, float fx, float fy, float cx, float cy);
+
+private:
+    void close();
+
+    intptr_t connection = -1;
+    uint32_t next_sequence = 0;
+};
@@ -0,0 +1,75 @@
+#include "frame_pattern.h"
+
+#include <system_error>
+
+std::expected<std::filesystem::path, std::string> format_frame_path(const std::string& pattern, int frame) {
+    std::string path;
+    bool expanded = false;
+
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] != '%') {
+            path += pattern[i];
+            continue;
+        }
+
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            path += '%';
+            i++;
+            continue;
+        }
+
+        // %[0][width]d
+        size_t j = i + 1;
+        const bool zero_pad = j < pattern.size() && pattern[j] == '0';
+        if (zero_pad)
+            j++;
+        size_t width = 0;
+        while (j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 64)
+            width = width * 10 + (pattern[j++] - '0');
+
+        if (j >= pattern.size() || (pattern[j] != 'd' && pattern[j] != 'i'))
+            return std::unexpected("Unsupported conversion in frame pattern " + pattern + ", expected one like %04d");
+        if (expanded)
+            return std::unexpected("Frame pattern " + pattern + " has more than one frame number");
+
+        auto number = std::to_string(frame);
+        if (number.size() < width)
+            number.insert(0, width - number.size(), zero_pad ? '0' : ' ');
+
+        path += number;
+        expanded = true;
+        i = j;
+    }
+
+    if (!expanded)
+        return std::unexpected("Frame pattern " + pattern + " has no frame number such as %04d");
+
+    return std::filesystem::path(path);
+}
+
+std::expected<int, std::string> count_sequence_frames(
+    const std::string& image_pattern,
+    const std::string& depth_pattern,
+    int first_frame
+) {
+    int count = 0;
+
+    for (;; count++) {
+        const auto image_path = format_frame_path(image_pattern, first_frame + count);
+        if (!image_path) return std::unexpected(image_path.error());
+
+        const auto depth_path = format_frame_path(depth_pattern, first_frame + count);
+        if (!depth_path) return std::unexpected(depth_path.error());
+
+        std::error_code error;
+        if (!std::filesystem::exists(*image_path, error) || !std::filesystem::exists(*depth_path, error))
+            break;
+    }
+
+    if (count == 0) {
+        const auto image_path = format_frame_path(image_pattern, first_frame);
+        return std::unexpected("No sequence frames found, starting at " + (*image_path).string());
+    }
+
+    return count;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <string>
+
+// Expands a printf-style frame pattern such as "frames/rgb_%04d.png". The pattern must hold
+// exactly one integer conversion, optionally zero padded to a width; "%%" is a literal percent.
+// Frame numbers are never negative.
+std::expected<std::filesystem::path, std::string> format_frame_path(const std::string& pattern, int frame);
+
+// Counts the consecutive frames from first_frame for which both files exist.
+std::expected<int, std::string> count_sequence_frames(
+    const std::string& image_pattern,
+    const std::string& depth_pattern,
+    int first_frame
+);
@@ -0,0 +1,81 @@
+#include "frame_timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+void timing_history_t::add(float ms) {
+    samples[next] = ms;
+    next = (next + 1) % capacity;
+    count = std::min(count + 1, capacity);
+}
+
+timing_stats_t timing_history_t::stats() const {
+    if (count == 0)
+        return {};
+
+    std::array<float, capacity> sorted;
+    std::copy_n(samples.begin(), count, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + count);
+
+    // Nearest rank, so with fewer than 100 samples p99 is the maximum.
+    const auto p99_rank = static_cast<size_t>(std::ceil(count * .99)) - 1;
+    return {
+        .min = sorted[0],
+        .avg = std::accumulate(sorted.begin(), sorted.begin() + count, 0.f) / count,
+        .p99 = sorted[p99_rank]
+    };
+}
+
+float cpu_timer_t::elapsed_ms() const {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+float cpu_timer_t::restart() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto ms = std::chrono::duration<float, std::milli>(now - start).count();
+    start = now;
+    return ms;
+}
+
+gpu_timer_t::gpu_timer_t() {
+    glGenQueries(query_count, queries.data());
+}
+
+gpu_timer_t::~gpu_timer_t() {
+    glDeleteQueries(query_count, queries.data());
+}
+
+void gpu_timer_t::begin() {
+    collect();
+
+    timing = pending < query_count;
+    if (timing)
+        glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+
+void gpu_timer_t::end() {
+    if (!timing)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    next = (next + 1) % query_count;
+    pending++;
+    timing = false;
+}
+
+void gpu_timer_t::collect() {
+    while (pending > 0) {
+        const auto query = queries[(next + query_count - pending) % query_count];
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        times.add(static_cast<float>(static_cast<double>(ns) / 1e6));
+        pending--;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <glad/glad.h>
+
+struct timing_stats_t {
+    float min;
+    float avg;
+    float p99;
+};
+
+// Rolling window of the last samples of one timer, in milliseconds.
+class timing_history_t {
+public:
+    static constexpr size_t capacity = 240;
+
+    void add(float ms);
+    // All zero until the first sample.
+    timing_stats_t stats() const;
+
+    // Ring buffer layout, as ImGui::PlotLines takes it. The oldest sample is at offset().
+    const float* data() const { return samples.data(); }
+    size_t size() const { return count; }
+    size_t offset() const { return count == capacity ? next : 0; }
+
+private:
+    std::array<float, capacity> samples = {};
+    size_t next = 0;
+    size_t count = 0;
+};
+
+// Measures CPU time from construction or the last restart.
+class cpu_timer_t {
+public:
+    cpu_timer_t() : start(std::chrono::steady_clock::now()) {}
+
+    float elapsed_ms() const;
+    // Returns the elapsed time and starts over.
+    float restart();
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// Times the GL commands between begin and end with GL_TIME_ELAPSED queries. Results are only
+// read once available a few frames later, so the CPU never waits on the GPU. Only one timer
+// may be between begin and end at a time.
+class gpu_timer_t {
+public:
+    // Needs a current GL context.
+    gpu_timer_t();
+    ~gpu_timer_t();
+
+    gpu_timer_t(const gpu_timer_t&) = delete;
+    gpu_timer_t& operator=(const gpu_timer_t&) = delete;
+
+    // Skips the frame if every query is still waiting on the GPU.
+    void begin();
+    void end();
+
+    const timing_history_t& history() const { return times; }
+
+private:
+    // Moves finished results into the history, oldest first.
+    void collect();
+
+    static constexpr size_t query_count = 4;
+
+    std::array<GLuint, query_count> queries = {};
+    size_t next = 0;
+    size_t pending = 0;
+    bool timing = false;
+    timing_history_t times;
+};
@@ -0,0 +1,248 @@
+#include "generation_job.h"
+
+#include <iostream>
+#include <optional>
+#include "cloud_cache.h"
+#include "image_cache.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "voxel_grid.h"
+
+// Where a freshly generated cloud goes in the cache, written once the cloud is published.
+struct cache_write_t {
+    std::filesystem::path path;
+    cloud_cache_key_t key;
+    uint32_t image_width;
+    uint32_t image_height;
+    uint64_t byte_budget;
+};
+
+static std::atomic<size_t> cloud_cache_writes;
+
+static std::expected<generation_output_t, std::string> run_generation(
+    const generation_request_t& request,
+    thread_pool_t& pool,
+    generation_progress_t& progress,
+    std::atomic<generation_stage_t>& stage,
+    std::optional<cache_write_t>& cache_write
+) {
+    TRACE_SCOPE("generation");
+
+    // Reopening a cloud maps it straight from the cache, skipping decode and generation.
+    std::optional<cloud_cache_key_t> cache_key;
+    std::filesystem::path cache_path;
+    if (!request.images_only && !request.images && !request.cache_dir.empty()) {
+        TRACE_SCOPE("cloud cache lookup");
+        if (auto source_hash = hash_source_files(request.image_path, request.depth_path)) {
+            cache_key = cloud_cache_key_t { *source_hash, request.intrinsics, request.stride, request.flying_pixel_threshold, request.voxel_size, request.layout };
+            cache_path = get_cloud_cache_path(request.cache_dir, *cache_key);
+
+            std::error_code error;
+            if (std::filesystem::exists(cache_path, error)) {
+                if (auto cached = read_cloud_cache(cache_path, *cache_key)) {
+                    // Touched so the budget evicts the least recently used clouds first.
+                    std::filesystem::last_write_time(cache_path, std::filesystem::file_time_type::clock::now(), error);
+                    return cached;
+                }
+            }
+        }
+    }
+
+    std::shared_ptr<const depth_images_t> images;
+    if (request.images)
+        images = request.images;
+    else if (request.image_cache) {
+        auto cached = request.image_cache->load(request.image_path, request.depth_path, &pool);
+        if (!cached)
+            return std::unexpected(cached.error());
+        images = std::move(*cached);
+    }
+    else {
+        auto loaded = load_depth_images(request.image_path, request.depth_path, &pool);
+        if (!loaded)
+            return std::unexpected(loaded.error());
+        images = std::make_shared<const depth_images_t>(std::move(*loaded));
+    }
+
+    generation_output_t output {
+        .images = nullptr,
+        .layout = request.layout,
+        .vertices = {},
+        .packed_vertices = {},
+        .order = {},
+        .position_offset = glm::vec3(0.f),
+        .position_extent = glm::vec3(1.f),
+        .octree = {},
+        .max_depth = 0.f,
+        .cache_file = {},
+        .cached_vertices = {}
+    };
+
+    if (request.images_only) {
+        output.max_depth = get_max_depth(*images);
+        output.images = std::move(images);
+        return output;
+    }
+
+    if (progress.cancelled)
+        return std::unexpected("Generation cancelled.");
+
+    // Filled in here, then shared once final.
+    std::vector<vertex_t> vertices;
+    std::vector<packed_vertex_t> packed_vertices;
+    std::vector<uint32_t> order;
+
+    stage = generation_stage_t::generating;
+    if (request.layout == vertex_layout_t::packed) {
+        auto result = generate_packed_depth_cloud(*images, request.intrinsics, request.stride, request.flying_pixel_threshold, pool, &progress);
+        packed_vertices = std::move(result.vertices);
+        output.position_offset = result.position_offset;
+        output.position_extent = result.position_extent;
+        output.max_depth = result.max_depth;
+    }
+    else {
+        auto result = generate_depth_cloud(*images, request.intrinsics, request.stride, request.flying_pixel_threshold, pool, &progress);
+        vertices = std::move(result.vertices);
+        output.max_depth = result.max_depth;
+    }
+
+    // The decoded images aren't needed past this point, unless the image cache holds on to them.
+    const auto image_width = images->width;
+    const auto image_height = images->height;
+    images.reset();
+
+    if (progress.cancelled)
+        return std::unexpected("Generation cancelled.");
+
+    if (request.voxel_size > 0.f) {
+        stage = generation_stage_t::downsampling;
+        // The packed cloud keeps its offset and extent, which still bound the averages.
+        if (request.layout == vertex_layout_t::packed)
+            packed_vertices = downsample_voxel_grid(packed_vertices, output.position_offset, output.position_extent, request.voxel_size, pool);
+        else
+            vertices = downsample_voxel_grid(vertices, request.voxel_size, pool);
+
+        if (progress.cancelled)
+            return std::unexpected("Generation cancelled.");
+    }
+
+    stage = generation_stage_t::building_octree;
+    if (request.layout == vertex_layout_t::packed)
+        output.octree = build_point_octree(packed_vertices, output.position_offset, output.position_extent, order, pool);
+    else
+        output.octree = build_point_octree(vertices, order, pool);
+
+    output.vertices = std::make_shared<const std::vector<vertex_t>>(std::move(vertices));
+    output.packed_vertices = std::make_shared<const std::vector<packed_vertex_t>>(std::move(packed_vertices));
+    output.order = std::make_shared<const std::vector<uint32_t>>(std::move(order));
+
+    if (cache_key)
+        cache_write = cache_write_t { cache_path, *cache_key, static_cast<uint32_t>(image_width), static_cast<uint32_t>(image_height), request.cache_byte_budget };
+
+    return output;
+}
+
+// What write_cloud_cache reads of a generated cloud, sharing the points rather than copying them.
+static generation_output_t share_cloud(const generation_output_t& output) {
+    return generation_output_t {
+        .images = nullptr,
+        .layout = output.layout,
+        .vertices = output.vertices,
+        .packed_vertices = output.packed_vertices,
+        .order = output.order,
+        .position_offset = output.position_offset,
+        .position_extent = output.position_extent,
+        .octree = output.octree,
+        .max_depth = output.max_depth,
+        .cache_file = {},
+        .cached_vertices = {}
+    };
+}
+
+generation_job_t::generation_job_t(generation_request_t request, thread_pool_t& pool, std::function<void()> on_finished)
+    : state(std::make_shared<state_t>()) {
+    pool.submit([state = state, request = std::move(request), &pool, on_finished = std::move(on_finished)]() {
+        std::optional<cache_write_t> cache_write;
+        auto result = run_generation(request, pool, state->progress, state->stage, cache_write);
+        // Taken before publishing, as the render thread moves the octree out of the result.
+        std::shared_ptr<const generation_output_t> cached;
+        if (cache_write && result && !state->progress.cancelled)
+            cached = std::make_shared<const generation_output_t>(share_cloud(*result));
+
+        state->result = state->progress.cancelled ? std::unexpected("Generation cancelled.") : std::move(result);
+        // Counted before publishing, so the write is pending by the time the job is seen finished.
+        if (cached)
+            cloud_cache_writes.fetch_add(1, std::memory_order_relaxed);
+        // Publishes the result to the render thread.
+        state->stage.store(generation_stage_t::finished, std::memory_order_release);
+
+        // Written afterwards on its own task, so the cloud doesn't wait on the disk to be uploaded.
+        if (cached) {
+            pool.submit([cache_write = std::move(*cache_write), cached, &pool]() {
+                TRACE_SCOPE("write cloud cache");
+                // A cache that can't be written only costs the next open its speed.
+                if (auto written = write_cloud_cache(cache_write.path, cache_write.key, *cached, cache_write.image_width, cache_write.image_height, pool); !written)
+                    std::cerr << written.error() << std::endl;
+                trim_cloud_cache(cache_write.path.parent_path(), cache_write.byte_budget);
+                cloud_cache_writes.fetch_sub(1, std::memory_order_release);
+            });
+        }
+
+        if (on_finished)
+            on_finished();
+    });
+}
+
+void generation_job_t::cancel() {
+    state->progress.cancelled = true;
+}
+
+bool generation_job_t::cancelled() const {
+    return state->progress.cancelled;
+}
+
+size_t pending_cloud_cache_writes() {
+    return cloud_cache_writes.load(std::memory_order_acquire);
+}
+
+bool generation_job_t::finished() const {
+    return state->stage.load(std::memory_order_acquire) == generation_stage_t::finished;
+}
+
+generation_stage_t generation_job_t::stage() const {
+    return state->stage.load(std::memory_order_acquire);
+}
+
+float generation_job_t::progress() const {
+    switch (stage()) {
+    case generation_stage_t::generating: {
+        const auto total = state->progress.rows_total.load(std::memory_order_relaxed);
+        return total ? static_cast<float>(state->progress.rows_done.load(std::memory_order_relaxed)) / total : 0.f;
+    }
+    case generation_stage_t::downsampling:
+    case generation_stage_t::building_octree:
+    case generation_stage_t::finished:
+        return 1.f;
+    default:
+        return 0.f;
+    }
+}
+
+std::expected<generation_output_t, std::string> generation_job_t::take_result() {
+    return std::move(state->result);
+}
+
+const char* generation_stage_name(generation_stage_t stage) {
+    switch (stage) {
+    case generation_stage_t::loading:
+        return "Loading images";
+    case generation_stage_t::generating:
+        return "Generating";
+    case generation_stage_t::downsampling:
+        return "Downsampling";
+    case generation_stage_t::building_octree:
+        return "Building octree";
+    default:
+        return "Finished";
+    }
+}
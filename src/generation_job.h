@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <expected>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+#include "mapped_file.h"
+#include "octree.h"
+
+class image_cache_t;
+class thread_pool_t;
+
+struct generation_request_t {
+    std::filesystem::path image_path;
+    std::filesystem::path depth_path;
+    camera_intrinsics_t intrinsics;
+    unsigned int stride;
+    // Drops samples on depth discontinuities when above 0, see filter_flying_pixels.
+    float flying_pixel_threshold;
+    // Averages the points into cells of this size when above 0, see downsample_voxel_grid.
+    float voxel_size;
+    // Only decode the images, for GPU reprojection.
+    bool images_only;
+    vertex_layout_t layout;
+    // Where generated clouds are cached and looked up. Empty disables the cache.
+    std::filesystem::path cache_dir;
+    // The oldest clouds are evicted once the cache holds more than this.
+    uint64_t cache_byte_budget;
+    // Decoded images are reused from here when set.
+    std::shared_ptr<image_cache_t> image_cache;
+    // Images already in memory, such as frames received over a socket. Used instead of the
+    // paths when set, and never cached.
+    std::shared_ptr<const depth_images_t> images;
+};
+
+// Everything the render thread needs to upload a new cloud.
+struct generation_output_t {
+    // Set when the request was images_only.
+    std::shared_ptr<const depth_images_t> images;
+    vertex_layout_t layout;
+    // Whichever of these matches layout holds the points, in generation order. They are
+    // only needed until uploaded, and shared with the cache write, which may finish later.
+    std::shared_ptr<const std::vector<vertex_t>> vertices;
+    std::shared_ptr<const std::vector<packed_vertex_t>> packed_vertices;
+    // Octree layout of the points, see build_point_octree. The reordered copy is gathered
+    // straight into the GL buffer rather than kept on the CPU.
+    std::shared_ptr<const std::vector<uint32_t>> order;
+    glm::vec3 position_offset;
+    glm::vec3 position_extent;
+    point_octree_t octree;
+    float max_depth;
+    // Set instead of the vectors when the cloud came from the cache. cached_vertices points
+    // into the mapping, ready to be handed to GL as is.
+    mapped_file_t cache_file;
+    std::span<const std::byte> cached_vertices;
+};
+
+enum class generation_stage_t {
+    loading,
+    generating,
+    downsampling,
+    building_octree,
+    finished
+};
+
+// Loads and generates a cloud on the thread pool, so the render thread stays responsive.
+class generation_job_t {
+public:
+    // on_finished is called from the worker once the result is ready, or cancellation took effect.
+    generation_job_t(generation_request_t request, thread_pool_t& pool, std::function<void()> on_finished);
+
+    generation_job_t(const generation_job_t&) = delete;
+    generation_job_t& operator=(const generation_job_t&) = delete;
+
+    void cancel();
+    bool cancelled() const;
+    bool finished() const;
+    generation_stage_t stage() const;
+    // Fraction of the current stage that is done, when it can be measured.
+    float progress() const;
+
+    // Only valid once finished().
+    std::expected<generation_output_t, std::string> take_result();
+
+private:
+    // Shared with the worker, which may still be running if the job is dropped after a cancel.
+    struct state_t {
+        generation_progress_t progress;
+        std::atomic<generation_stage_t> stage = generation_stage_t::loading;
+        std::expected<generation_output_t, std::string> result = std::unexpected(std::string());
+    };
+
+    std::shared_ptr<state_t> state;
+};
+
+const char* generation_stage_name(generation_stage_t stage);
+
+// Cloud cache writes still running on the pool after their job finished. Replacing the pool
+// waits for them, so it should wait until this is zero.
+size_t pending_cloud_cache_writes();
@@ -0,0 +1,99 @@
+#include "image_cache.h"
+
+image_cache_t::image_cache_t(size_t byte_budget)
+    : budget(byte_budget) {
+}
+
+std::expected<std::shared_ptr<const depth_images_t>, std::string> image_cache_t::load(
+    const std::filesystem::path& image_path,
+    const std::filesystem::path& depth_path,
+    thread_pool_t* pool
+) {
+    const auto get_key = [](const std::filesystem::path& path) -> std::expected<file_key_t, std::string> {
+        std::error_code error;
+        const auto modified = std::filesystem::last_write_time(path, error);
+        const auto size = error ? 0 : std::filesystem::file_size(path, error);
+        if (error)
+            return std::unexpected("Failed to read " + path.string() + ": " + error.message());
+        return file_key_t { path, modified, size };
+    };
+
+    const auto image_key = get_key(image_path);
+    if (!image_key)
+        return std::unexpected(image_key.error());
+    const auto depth_key = get_key(depth_path);
+    if (!depth_key)
+        return std::unexpected(depth_key.error());
+
+    {
+        std::lock_guard lock(mutex);
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->image == *image_key && it->depth == *depth_key) {
+                entries.splice(entries.begin(), entries, it);
+                return it->images;
+            }
+        }
+    }
+
+    // Decoded without holding the lock, so other lookups aren't held up behind it. Two threads
+    // missing on the same pair both decode it, and the second insert is dropped.
+    auto images = load_depth_images(image_path, depth_path, pool);
+    if (!images)
+        return std::unexpected(images.error());
+
+    auto shared = std::make_shared<const depth_images_t>(std::move(*images));
+    const size_t bytes = get_depth_images_bytes(*shared);
+
+    std::lock_guard lock(mutex);
+    if (bytes > budget)
+        return shared;
+
+    // Drops older versions of the same files, which can never be hit again.
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->image == *image_key && it->depth == *depth_key)
+            return shared;
+
+        if (it->image.path == image_path && it->depth.path == depth_path) {
+            used -= it->bytes;
+            it = entries.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    evict(budget - bytes);
+    entries.push_front(entry_t { *image_key, *depth_key, shared, bytes });
+    used += bytes;
+    return shared;
+}
+
+void image_cache_t::set_byte_budget(size_t byte_budget) {
+    std::lock_guard lock(mutex);
+    budget = byte_budget;
+    evict(budget);
+}
+
+size_t image_cache_t::byte_budget() const {
+    std::lock_guard lock(mutex);
+    return budget;
+}
+
+size_t image_cache_t::bytes_used() const {
+    std::lock_guard lock(mutex);
+    return used;
+}
+
+void image_cache_t::evict(size_t target) {
+    // Images still in use by a job stay alive through their shared_ptr, they just stop being cached.
+    while (used > target && !entries.empty()) {
+        used -= entries.back().bytes;
+        entries.pop_back();
+    }
+}
+
+size_t get_depth_images_bytes(const depth_images_t& images) {
+    const size_t pixels = static_cast<size_t>(images.width) * images.height;
+    // Float depth used in place lives in the page cache rather than on the heap.
+    const size_t depth_size = images.depth ? sizeof(uint16_t) : images.metric_depth.pixels ? sizeof(float) : 0;
+    return pixels * (3 * sizeof(uint8_t) + depth_size);
+}
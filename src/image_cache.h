@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "depth_cloud.h"
+
+class thread_pool_t;
+
+// Least recently used cache of decoded image pairs, so regenerating with different parameters
+// skips the decode. Entries are keyed on both files' path, modification time and size, and
+// evicted once the decoded pixels exceed the byte budget. Safe to use from any thread.
+class image_cache_t {
+public:
+    explicit image_cache_t(size_t byte_budget);
+
+    image_cache_t(const image_cache_t&) = delete;
+    image_cache_t& operator=(const image_cache_t&) = delete;
+
+    // Returns the cached images if neither file changed since they were decoded, otherwise
+    // decodes and caches them. Pairs larger than the whole budget are returned uncached.
+    std::expected<std::shared_ptr<const depth_images_t>, std::string> load(
+        const std::filesystem::path& image_path,
+        const std::filesystem::path& depth_path,
+        thread_pool_t* pool = nullptr
+    );
+
+    // Evicts down to the new budget straight away.
+    void set_byte_budget(size_t byte_budget);
+    size_t byte_budget() const;
+    size_t bytes_used() const;
+
+private:
+    struct file_key_t {
+        std::filesystem::path path;
+        std::filesystem::file_time_type modified;
+        uintmax_t size;
+
+        bool operator==(const file_key_t&) const = default;
+    };
+
+    struct entry_t {
+        file_key_t image;
+        file_key_t depth;
+        std::shared_ptr<const depth_images_t> images;
+        size_t bytes;
+    };
+
+    void evict(size_t budget);
+
+    mutable std::mutex mutex;
+    // Most recently used first.
+    std::list<entry_t> entries;
+    size_t budget;
+    size_t used = 0;
+};
+
+// Bytes of decoded pixels held by a pair of images.
+size_t get_depth_images_bytes(const depth_images_t& images);
@@ -0,0 +1,230 @@
+#include "image_decoder.h"
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#include "mapped_file.h"
+
+#ifdef ZOE_HAVE_SPNG
+#include <spng.h>
+#endif
+#ifdef ZOE_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+// Every backend allocates pixels with malloc, which is also what stb_image uses.
+void image_free_t::operator()(void* pixels) const {
+    std::free(pixels);
+}
+
+static std::expected<decoded_rgb_image_t, std::string> decode_rgb_stb(const std::filesystem::path& path) {
+    decoded_rgb_image_t image { 0, 0, 0, nullptr };
+    image.pixels = rgb_pixels_t(stbi_load(path.string().c_str(), &image.width, &image.height, &image.channels, 3));
+    if (!image.pixels)
+        return std::unexpected("Failed to read " + path.string() + ".");
+    return image;
+}
+
+static std::expected<decoded_depth_image_t, std::string> decode_depth_stb(const std::filesystem::path& path) {
+    decoded_depth_image_t image { 0, 0, 0, nullptr };
+    // Loaded as a single channel so depth rows are contiguous 16-bit samples.
+    image.pixels = depth_pixels_t(stbi_load_16(path.string().c_str(), &image.width, &image.height, &image.channels, 1));
+    if (!image.pixels)
+        return std::unexpected("Failed to read " + path.string() + ".");
+    return image;
+}
+
+#ifdef ZOE_HAVE_SPNG
+
+// Owns a libspng context reading from a mapped file.
+struct spng_reader_t {
+    spng_ctx* ctx = spng_ctx_new(0);
+    spng_ihdr ihdr = {};
+
+    ~spng_reader_t() {
+        spng_ctx_free(ctx);
+    }
+
+    bool open(const mapped_file_t& file) {
+        const auto bytes = file.bytes();
+        return ctx
+            && spng_set_png_buffer(ctx, bytes.data(), bytes.size()) == 0
+            && spng_get_ihdr(ctx, &ihdr) == 0;
+    }
+
+    template <typename Pixels>
+    Pixels decode(int format) {
+        size_t size = 0;
+        if (spng_decoded_image_size(ctx, format, &size) != 0)
+            return nullptr;
+
+        Pixels pixels(static_cast<typename Pixels::element_type*>(std::malloc(size)));
+        if (pixels && spng_decode_image(ctx, pixels.get(), size, format, SPNG_DECODE_TRNS) != 0)
+            pixels.reset();
+        return pixels;
+    }
+
+    int channels() const {
+        switch (ihdr.color_type) {
+        case SPNG_COLOR_TYPE_GRAYSCALE:
+            return 1;
+        case SPNG_COLOR_TYPE_GRAYSCALE_ALPHA:
+            return 2;
+        case SPNG_COLOR_TYPE_TRUECOLOR_ALPHA:
+            return 4;
+        default:
+            return 3;
+        }
+    }
+};
+
+static std::expected<decoded_rgb_image_t, std::string> decode_rgb_spng(const std::filesystem::path& path) {
+    auto file = mapped_file_t::open(path);
+    if (!file)
+        return std::unexpected(file.error());
+
+    spng_reader_t reader;
+    if (!reader.open(*file))
+        return std::unexpected("Failed to read " + path.string() + ".");
+
+    decoded_rgb_image_t image {
+        .width = static_cast<int>(reader.ihdr.width),
+        .height = static_cast<int>(reader.ihdr.height),
+        .channels = reader.channels(),
+        .pixels = reader.decode<rgb_pixels_t>(SPNG_FMT_RGB8)
+    };
+    if (!image.pixels)
+        return std::unexpected("Failed to decode " + path.string() + ".");
+    return image;
+}
+
+static std::expected<decoded_depth_image_t, std::string> decode_depth_spng(const std::filesystem::path& path) {
+    auto file = mapped_file_t::open(path);
+    if (!file)
+        return std::unexpected(file.error());
+
+    spng_reader_t reader;
+    if (!reader.open(*file))
+        return std::unexpected("Failed to read " + path.string() + ".");
+
+    // SPNG_FMT_PNG keeps the file's own format in host byte order, which is exactly what is
+    // wanted for 16-bit grayscale. stb converts anything else.
+    if (reader.ihdr.color_type != SPNG_COLOR_TYPE_GRAYSCALE || reader.ihdr.bit_depth != 16)
+        return decode_depth_stb(path);
+
+    decoded_depth_image_t image {
+        .width = static_cast<int>(reader.ihdr.width),
+        .height = static_cast<int>(reader.ihdr.height),
+        .channels = 1,
+        .pixels = reader.decode<depth_pixels_t>(SPNG_FMT_PNG)
+    };
+    if (!image.pixels)
+        return std::unexpected("Failed to decode " + path.string() + ".");
+    return image;
+}
+
+#endif
+
+#ifdef ZOE_HAVE_TURBOJPEG
+
+static std::expected<decoded_rgb_image_t, std::string> decode_rgb_turbojpeg(const std::filesystem::path& path) {
+    auto file = mapped_file_t::open(path);
+    if (!file)
+        return std::unexpected(file.error());
+
+    const auto bytes = file->bytes();
+    const auto jpeg = reinterpret_cast<const unsigned char*>(bytes.data());
+
+    const auto handle = tjInitDecompress();
+    if (!handle)
+        return std::unexpected("Failed to initialise libjpeg-turbo.");
+
+    decoded_rgb_image_t image { 0, 0, 0, nullptr };
+    int subsampling, colorspace;
+    if (tjDecompressHeader3(handle, jpeg, static_cast<unsigned long>(bytes.size()), &image.width, &image.height, &subsampling, &colorspace) == 0) {
+        image.channels = colorspace == TJCS_GRAY ? 1 : 3;
+        image.pixels = rgb_pixels_t(static_cast<uint8_t*>(std::malloc(static_cast<size_t>(image.width) * image.height * 3)));
+        if (image.pixels && tjDecompress2(handle, jpeg, static_cast<unsigned long>(bytes.size()), image.pixels.get(), image.width, 0, image.height, TJPF_RGB, 0) != 0)
+            image.pixels.reset();
+    }
+    tjDestroy(handle);
+
+    if (!image.pixels)
+        return std::unexpected("Failed to decode " + path.string() + ".");
+    return image;
+}
+
+#endif
+
+bool image_decoder_supported(image_decoder_t decoder) {
+    switch (decoder) {
+#ifdef ZOE_HAVE_SPNG
+    case image_decoder_t::spng:
+        return true;
+#endif
+#ifdef ZOE_HAVE_TURBOJPEG
+    case image_decoder_t::turbojpeg:
+        return true;
+#endif
+    case image_decoder_t::stb:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char* image_decoder_name(image_decoder_t decoder) {
+    switch (decoder) {
+    case image_decoder_t::spng:
+        return "libspng";
+    case image_decoder_t::turbojpeg:
+        return "libjpeg-turbo";
+    default:
+        return "stb_image";
+    }
+}
+
+image_decoder_t pick_image_decoder(const std::filesystem::path& path) {
+    std::array<unsigned char, 8> signature = {};
+    std::ifstream ifs(path, std::ios::binary);
+    ifs.read(reinterpret_cast<char*>(signature.data()), signature.size());
+
+    constexpr std::array<unsigned char, 8> png_signature = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (signature == png_signature && image_decoder_supported(image_decoder_t::spng))
+        return image_decoder_t::spng;
+
+    if (signature[0] == 0xff && signature[1] == 0xd8 && image_decoder_supported(image_decoder_t::turbojpeg))
+        return image_decoder_t::turbojpeg;
+
+    return image_decoder_t::stb;
+}
+
+std::expected<decoded_rgb_image_t, std::string> decode_rgb_image(image_decoder_t decoder, const std::filesystem::path& path) {
+    switch (decoder) {
+#ifdef ZOE_HAVE_SPNG
+    case image_decoder_t::spng:
+        return decode_rgb_spng(path);
+#endif
+#ifdef ZOE_HAVE_TURBOJPEG
+    case image_decoder_t::turbojpeg:
+        return decode_rgb_turbojpeg(path);
+#endif
+    default:
+        return decode_rgb_stb(path);
+    }
+}
+
+std::expected<decoded_depth_image_t, std::string> decode_depth_image(image_decoder_t decoder, const std::filesystem::path& path) {
+    switch (decoder) {
+#ifdef ZOE_HAVE_SPNG
+    case image_decoder_t::spng:
+        return decode_depth_spng(path);
+#endif
+    // Depth maps are 16-bit, which JPEG can't hold.
+    default:
+        return decode_depth_stb(path);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <string>
+#include "depth_cloud.h"
+
+// Image decoding backends. stb_image is always available. The others are compiled in by
+// defining ZOE_HAVE_SPNG or ZOE_HAVE_TURBOJPEG and linking the library.
+enum class image_decoder_t {
+    stb,
+    // libspng, for PNG.
+    spng,
+    // libjpeg-turbo, for JPEG.
+    turbojpeg
+};
+
+// Decoded pixels, and the number of channels stored in the file, which can differ from the
+// number decoded to.
+struct decoded_rgb_image_t {
+    int width;
+    int height;
+    int channels;
+    rgb_pixels_t pixels;
+};
+
+struct decoded_depth_image_t {
+    int width;
+    int height;
+    int channels;
+    depth_pixels_t pixels;
+};
+
+bool image_decoder_supported(image_decoder_t decoder);
+const char* image_decoder_name(image_decoder_t decoder);
+
+// The fastest supported decoder for the file's format, going by its signature. Falls back to stb.
+image_decoder_t pick_image_decoder(const std::filesystem::path& path);
+
+// Decodes to interleaved 8-bit RGB. Backends hand file variants they don't handle to stb.
+std::expected<decoded_rgb_image_t, std::string> decode_rgb_image(image_decoder_t decoder, const std::filesystem::path& path);
+// Decodes to a single 16-bit channel. Backends hand file variants they don't handle to stb.
+std::expected<decoded_depth_image_t, std::string> decode_depth_image(image_decoder_t decoder, const std::filesystem::path& path);
@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <vector>
 #include <filesystem>
 #include <fstream>
@@ -9,209 +16,185 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
 #include "imgui.h"
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_opengl3.h"
-
-struct vertex_t {
-	glm::vec3 position;
-    glm::vec3 color;
-};
-
-struct depth_cloud_result_t {
-    std::vector<vertex_t> vertices;
-    float max_depth;
-};
-
-struct mesh_t {
-    std::vector<float> vertices;
-    std::vector<unsigned int> indices;
-};
-
-struct camera_t {
-    glm::vec3 origin;
-    float distance;
-    float pitch;
-    float yaw;
-    float rotate_speed;
-    float pan_speed;
-    float zoom_scale;
-};
-
-static std::expected<std::string, std::string> read_file_contents(const std::filesystem::path& path) {
-    std::ifstream ifs(path);
-
-    if (ifs.fail()) 
-        return std::unexpected("Failed to read contents of file " + path.string());
-
-    return std::string(
-        (std::istreambuf_iterator<char>(ifs)),
-        (std::istreambuf_iterator<char>())
-    );
+#include "batch.h"
+#include "camera.h"
+#include "cloud_cache.h"
+#include "depth_cloud.h"
+#include "depth_kernel.h"
+#include "frame_ingest.h"
+#include "frame_timing.h"
+#include "generation_job.h"
+#include "image_cache.h"
+#include "octree.h"
+#include "point_renderer.h"
+#include "point_stream.h"
+#include "sequence.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Starts streaming generated points into the point cloud VBO. They become visible over the
+// next frames as point_stream.update uploads them.
+static point_cloud_t upload_point_cloud(generation_output_t&& output, GLuint vbo, point_stream_t& point_stream) {
+    auto point_cloud = point_cloud_t {
+        .layout = output.layout,
+        .count = 0,
+        .position_offset = output.position_offset,
+        .position_extent = output.position_extent,
+        .octree = std::move(output.octree),
+        .uploaded = 0
+    };
+    point_cloud.count = point_stream.begin(vbo, std::move(output));
+    return point_cloud;
 }
 
-static std::expected<GLuint, std::string> create_shader(GLenum type, const std::string& src) {
-    auto id = glCreateShader(type);
-
-    const char* src_cstr = src.c_str();
-    glShaderSource(id, 1, &src_cstr, nullptr);
-    glCompileShader(id);
-
-    GLint success;
-    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLsizei log_length;
-        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &log_length);
-
-        std::string log;
-        if (log_length > 0) {
-            log.resize(log_length);
-            glGetShaderInfoLog(id, log_length, nullptr, &log[0]);
+// Rows of min/avg/p99 milliseconds, each followed by a graph of its recent samples.
+static void show_timings(std::span<const std::pair<const char*, const timing_history_t*>> timings) {
+    if (ImGui::BeginTable("Timings", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Avg");
+        ImGui::TableSetupColumn("P99");
+        ImGui::TableHeadersRow();
+
+        for (const auto& [name, history] : timings) {
+            const auto stats = history->stats();
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stats.min);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stats.avg);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stats.p99);
         }
-
-        // Cleanup resource if it fails to compile.
-        glDeleteShader(id);
-
-        return std::unexpected("Shader compilation error: " + log);
+        ImGui::EndTable();
     }
 
-    return id;
-}
-
-static std::expected<GLuint, std::string> create_program(GLuint vs, GLuint fs) {
-    auto program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    glLinkProgram(program);
-
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        GLsizei log_length;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_length);
-
-        std::string log;
-        if (log_length > 0) {
-            log.resize(log_length);
-            glGetProgramInfoLog(program, log_length, nullptr, &log[0]);
-        }
-
-        // Cleanup resource if it fails to link.
-        glDeleteProgram(program);
-
-        return std::unexpected("Shader program linking error: " + log);
+    for (const auto& [name, history] : timings) {
+        // Scaled to the p99 so a single spike doesn't flatten the rest.
+        const auto stats = history->stats();
+        ImGui::PlotLines(name, history->data(), static_cast<int>(history->size()), static_cast<int>(history->offset()),
+            nullptr, 0.f, std::max(stats.p99 * 1.25f, .01f), ImVec2(0.f, 40.f));
     }
-
-    return program;
 }
 
-static std::expected<GLuint, std::string> create_program(
-    const std::filesystem::path& vs_path,
-    const std::filesystem::path& fs_path
-) {
-    const auto vs_src = read_file_contents(vs_path);
-    if (!vs_src) return std::unexpected(vs_src.error());
-
-    const auto fs_src = read_file_contents(fs_path);
-    if (!fs_src) return std::unexpected(fs_src.error());
-
-    const auto vs = create_shader(GL_VERTEX_SHADER, *vs_src);
-    if (!vs) return std::unexpected(vs.error());
-
-    const auto fs = create_shader(GL_FRAGMENT_SHADER, *fs_src);
-    // Be sure to delete vs, if fs fails.
-    if (!fs) {
-        glDeleteShader(*vs);
-        return std::unexpected(fs.error());
-    }
-
-    const auto program = create_program(*vs, *fs);
-    // Delete now we have made program. This will also delete if program fails too.
-    glDeleteShader(*vs);
-    glDeleteShader(*fs);
-    if (!program)
-        return std::unexpected(program.error());
-    return program;
+// Reports how writing the trace went, for --trace.
+static void save_trace(const std::filesystem::path& path) {
+    if (auto spans = stop_trace(path))
+        std::cout << "Wrote " << *spans << " trace spans to " << path.string() << std::endl;
+    else
+        std::cerr << spans.error() << std::endl;
 }
 
-static std::expected<depth_cloud_result_t, std::string> generate_depth_cloud(
-    const std::filesystem::path& image_path,
-    const std::filesystem::path& depth_path,
-    float focal_length,
-    unsigned int stride
-) {
-    int w1, h1, ch1, w2, h2, ch2;
-    unsigned char* pixels1 = stbi_load(image_path.string().c_str(), &w1, &h1, &ch1, 3);
-    unsigned short* pixels2 = stbi_load_16(depth_path.string().c_str(), &w2, &h2, &ch2, 3);
-
-    if (!pixels1 || !pixels2) 
-        return std::unexpected("Failed to read image or depth map.");
-
-    if (w1 != w2 || h1 != h2 || ch1 != 3 || ch2 != 1) {
-        stbi_image_free(pixels1);
-        stbi_image_free(pixels2);
-        return std::unexpected("Image and depth map not same resolution or invalid channel count.");
-    }
-
-    const float center_w = static_cast<float>(w1) * .5f;
-    const float center_h = static_cast<float>(h1) * .5f;
-
-    std::vector<vertex_t> vertices = {};
-    vertices.reserve(w1 * h1);
-
-    float max_depth = 0.f;
-
-    for (int v = 0; v < h1; v += stride){
-        for (int u = 0; u < w1; u += stride) {
-            if (v >= h1 || u >= w1)
-                continue;
-
-            const int index = (u + v * w1) * ch1;
-            const unsigned char r = pixels1[index];
-            const unsigned char g = pixels1[index + 1];
-            const unsigned char b = pixels1[index + 2];
-            // Not sure why this index works here even though it's single channel.
-            const unsigned short gray = pixels2[index];
-
-            // ZoeDepth maps are metric scaled down by 255.
-            const float depth = static_cast<float>(gray) / 255.0f;
-
-            if (depth > max_depth)
-                max_depth = depth;
-
-            glm::vec3 position(
-                depth * (w1 - u - center_w) / focal_length,
-                depth * (h1 - v - center_h) / focal_length,
-                depth
-            );
-
-            glm::vec3 color(
-                static_cast<float>(r) / 255.f,
-                static_cast<float>(g) / 255.f,
-                static_cast<float>(b) / 255.f
-            );
+// Wakes the main loop if it is idle, so results from other threads are picked up straight away.
+static void wake_main_loop() {
+    SDL_Event wake_event = {};
+    wake_event.type = SDL_USEREVENT;
+    SDL_PushEvent(&wake_event);
+}
 
-            vertices.emplace_back(position, color);
+int main(int argc, char** argv) {
+    // 0 means one worker per hardware thread.
+    int worker_threads = 0;
+    bool batch = false;
+    batch_options_t batch_options;
+    std::vector<std::string> inputs;
+    std::string listen_path;
+    // Records from startup and writes the trace on exit.
+    std::string trace_path;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--threads" && has_value)
+            worker_threads = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--trace" && has_value)
+            trace_path = argv[++i];
+        else if (arg == "--listen" && has_value)
+            listen_path = argv[++i];
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--manifest" && has_value) {
+            auto items = read_batch_manifest(argv[++i]);
+            if (!items) {
+                std::cerr << items.error() << std::endl;
+                return EXIT_FAILURE;
+            }
+            batch_options.items.insert(batch_options.items.end(), items->begin(), items->end());
+        }
+        else if (arg == "--output-dir" && has_value)
+            batch_options.output_dir = argv[++i];
+        else if (arg == "--focal-length" && has_value) {
+            batch_options.intrinsics.fx = static_cast<float>(std::atof(argv[++i]));
+            batch_options.intrinsics.fy = batch_options.intrinsics.fx;
+        }
+        else if (arg == "--principal-point" && has_value) {
+            auto& intrinsics = batch_options.intrinsics;
+            if (std::sscanf(argv[++i], "%f,%f", &intrinsics.cx, &intrinsics.cy) != 2) {
+                std::cerr << "--principal-point takes CX,CY." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--distortion" && has_value) {
+            // OpenCV's order, trailing coefficients can be left out.
+            auto& intrinsics = batch_options.intrinsics;
+            intrinsics.k1 = intrinsics.k2 = intrinsics.p1 = intrinsics.p2 = intrinsics.k3 = 0.f;
+            if (std::sscanf(argv[++i], "%f,%f,%f,%f,%f", &intrinsics.k1, &intrinsics.k2, &intrinsics.p1, &intrinsics.p2, &intrinsics.k3) < 1) {
+                std::cerr << "--distortion takes K1[,K2[,P1[,P2[,K3]]]]." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--stride" && has_value)
+            batch_options.stride = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--flying-pixel-threshold" && has_value)
+            batch_options.flying_pixel_threshold = std::max(0.f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--voxel-grid" && has_value)
+            batch_options.voxel_size = std::max(0.f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--jobs" && has_value)
+            batch_options.jobs = std::max(0, std::atoi(argv[++i]));
+        else if (!arg.starts_with("--"))
+            inputs.push_back(arg);
+        else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--listen SOCKET] [--trace FILE]" << std::endl;
+            std::cerr << "       " << argv[0] << " --batch [--threads N] [--jobs N] [--focal-length F] [--stride N] [--trace FILE]" << std::endl;
+            std::cerr << "           [--principal-point CX,CY] [--distortion K1,K2,P1,P2,K3] [--flying-pixel-threshold T]" << std::endl;
+            std::cerr << "           [--voxel-grid SIZE]" << std::endl;
+            std::cerr << "           [--output-dir DIR] [--manifest FILE] [IMAGE DEPTH]..." << std::endl;
+            return EXIT_FAILURE;
         }
     }
 
-    stbi_image_free(pixels1);
-    stbi_image_free(pixels2);
-
-    return depth_cloud_result_t { vertices, max_depth };
-}
-
-glm::vec3 get_camera_front(float pitch, float yaw) {
-    auto front = glm::vec3();
-    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front.y = sin(glm::radians(pitch));
-    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    return glm::normalize(front);
-}
+    if (!batch && (!inputs.empty() || !batch_options.items.empty())) {
+        std::cerr << "Input files are only accepted with --batch." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (inputs.size() % 2 != 0) {
+        std::cerr << "Inputs must be given as IMAGE DEPTH pairs." << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < inputs.size(); i += 2)
+        batch_options.items.emplace_back(inputs[i], inputs[i + 1]);
+
+    set_trace_thread_name("main");
+    if (!trace_path.empty())
+        start_trace();
+
+    auto pool = std::make_unique<thread_pool_t>(worker_threads);
+    worker_threads = pool->thread_count();
+
+    // Headless conversion never needs a window or a GL context.
+    if (batch) {
+        const int result = run_batch(batch_options, *pool);
+        if (!trace_path.empty())
+            save_trace(trace_path);
+        return result;
+    }
 
-int main(int argc, char** argv) {
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		std::cerr << "SDL initialization failure: " << SDL_GetError() << std::endl;
 		return EXIT_FAILURE;
@@ -246,77 +229,20 @@ int main(int argc, char** argv) {
 	}
 
     glEnable(GL_DEPTH_TEST);
+    // Sprites size themselves from the projection in the vertex shader.
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
-    const auto shader_program_result = create_program("shader.vs", "shader.fs");
-    if (!shader_program_result) {
-        std::cerr << "Failed to create shader program: " << shader_program_result.error() << std::endl;
+    auto renderer_result = point_renderer_t::create("shader.vs", "shader.fs");
+    if (!renderer_result) {
+        std::cerr << "Failed to create shader program: " << renderer_result.error() << std::endl;
         return EXIT_FAILURE;
     }
-    const auto shader_program = *shader_program_result;
-    glUseProgram(shader_program);
-
-    const auto projection_uniform = glGetUniformLocation(shader_program, "projection_matrix");
-    const auto view_uniform = glGetUniformLocation(shader_program, "view_matrix");
-    const auto model_uniform = glGetUniformLocation(shader_program, "model_matrix");
-
-    const mesh_t cube_mesh{
-        .vertices = {
-            -1, -1, -1,
-            1, -1, -1,
-            1, 1, -1,
-            -1, 1, -1,
-            -1, -1, 1,
-            1, -1, 1,
-            1, 1, 1,
-            -1, 1, 1
-        },
-        .indices = {
-            0, 1, 3,
-            3, 1, 2,
-            1, 5, 2,
-            2, 5, 6,
-            5, 4, 6,
-            6, 4, 7,
-            4, 0, 7,
-            7, 0, 3,
-            3, 2, 7,
-            7, 2, 6,
-            4, 5, 0,
-            0, 5, 1
-        }
-    };
+    const auto renderer = std::move(*renderer_result);
 
-	GLuint vao, mesh_vbo, mesh_ebo, point_cloud_vbo;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-    glGenBuffers(1, &mesh_vbo);
-    glGenBuffers(1, &mesh_ebo);
+    GLuint point_cloud_vbo;
     glGenBuffers(1, &point_cloud_vbo);
 
-    glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
-    glBufferData(GL_ARRAY_BUFFER, cube_mesh.vertices.size() * sizeof(float), cube_mesh.vertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cube_mesh.indices.size() * sizeof(unsigned int), cube_mesh.indices.data(), GL_STATIC_DRAW);
-
-    // TODO: Fix sizing
-    // Cube mesh vertex position.
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray(0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, point_cloud_vbo);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), 0);
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(sizeof(glm::vec3)));
-    glEnableVertexAttribArray(2);
-
-    // Position
-    glVertexAttribDivisor(1, 1);
-    // Color
-    glVertexAttribDivisor(2, 1);
+    point_stream_t point_stream;
 
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
@@ -336,11 +262,54 @@ int main(int argc, char** argv) {
     };
 
 
-    std::optional<std::vector<vertex_t>> vertices = std::nullopt;
+    std::optional<point_cloud_t> point_cloud = std::nullopt;
+    std::unique_ptr<generation_job_t> generation_job;
+    bool compact_vertices = false;
+    bool cache_clouds = true;
+    const auto cloud_cache_dir = default_cloud_cache_dir();
+    // Disk space for cached clouds, in megabytes.
+    int cloud_cache_mb = 4096;
+    // Decoded image pairs kept around for regenerating with new parameters, in megabytes.
+    int image_cache_mb = 1024;
+    const auto image_cache = std::make_shared<image_cache_t>(static_cast<size_t>(image_cache_mb) << 20);
+    // Sequence playback swaps the ring's frames into point_cloud, and puts the single cloud
+    // back once stopped.
+    std::unique_ptr<sequence_player_t> sequence_player;
+    std::optional<point_cloud_t> single_point_cloud = std::nullopt;
+    char image_pattern_str[128] = "";
+    char depth_pattern_str[128] = "";
+    int sequence_first_frame = 0;
+    float sequence_fps = 30.f;
+    int sequence_ring_size = 8;
+    bool sequence_loop = true;
+    // Raw frames from a local producer, see frame_ingest.h.
+    std::unique_ptr<frame_listener_t> frame_listener;
+    char socket_path_str[128] = "";
+    std::snprintf(socket_path_str, sizeof(socket_path_str), "%s", (std::filesystem::temp_directory_path() / "zoe-pointcloud.sock").string().c_str());
+    // Live frames only recenter the camera on the first one, so it can still be moved.
+    bool ingest_centered = false;
+    // Sent with the last live frame, for the shader to reproject it with. Kept apart from the
+    // UI's, which may hold lens distortion the wire format can't carry.
+    std::optional<camera_intrinsics_t> ingest_intrinsics;
+    bool recenter_camera = true;
+    bool frustum_culling = true;
+    bool level_of_detail = true;
+    float lod_point_spacing = 1.f;
+    // In millions of points.
+    float lod_point_budget = 10.f;
+    point_draw_stats_t draw_stats = {};
+    bool gpu_reprojection = false;
+    auto render_mode = render_mode_t::cube;
+    auto splat_shape = splat_shape_t::round;
     char image_file_str[128] = "";
     char depth_file_str[128] = "";
-    auto focal_length = 1400.f;
+    auto intrinsics = make_pinhole_intrinsics(1400.f);
     auto stride = 4;
+    bool remove_flying_pixels = false;
+    float flying_pixel_threshold = .1f;
+    bool use_voxel_grid = false;
+    // In metres.
+    float voxel_grid_size = .02f;
     auto background_color = glm::vec3();
     float voxel_scale = .01f;
 
@@ -350,21 +319,77 @@ int main(int argc, char** argv) {
 
     // TODO: Move some of these
     SDL_Event event;
-    Uint32 prev_time, cur_time = 0;
+    Uint64 prev_counter = SDL_GetPerformanceCounter();
     std::string last_error_message = "";
     bool running = true;
 
+    // Idle mode stops redrawing once nothing has changed for this long, which leaves time for
+    // ImGui's hover delays and fades to finish after the last input.
+    const Uint32 settle_ms = 500;
+    Uint32 redraw_until = 0;
+    bool idle_when_static = true;
+
+    // Rolling timings for the Performance section, in milliseconds. Frame times leave out
+    // frames that started by waking from idle.
+    timing_history_t frame_times;
+    timing_history_t event_times;
+    timing_history_t matrix_times;
+    timing_history_t cull_times;
+    timing_history_t ui_times;
+    gpu_timer_t point_pass_timer;
+    gpu_timer_t imgui_pass_timer;
+#if ZOE_TRACING
+    // Where the Tracing panel writes a recording to.
+    char trace_file_str[128] = "zoe-pointcloud-trace.json";
+#endif
+
+    if (!listen_path.empty()) {
+        std::snprintf(socket_path_str, sizeof(socket_path_str), "%s", listen_path.c_str());
+        auto listener = frame_listener_t::listen(listen_path, wake_main_loop);
+        if (!listener) {
+            std::cerr << listener.error() << std::endl;
+            return EXIT_FAILURE;
+        }
+        frame_listener = std::move(*listener);
+    }
+
     while (running) {
-        prev_time = cur_time;
-        cur_time = SDL_GetTicks();
-        const auto fps = 1.f / (static_cast<float>(cur_time - prev_time) / 1000.f);
+        // Keep the progress bar moving while generating in the background, keep streaming
+        // a new cloud in, keep a sequence playing, and re-enable the worker threads slider once
+        // the cloud cache is written.
+        if (generation_job || pending_cloud_cache_writes() > 0 || point_stream.active() || (sequence_player && sequence_player->playing()))
+            redraw_until = SDL_GetTicks() + settle_ms;
+
+        // Sleep until the next event once the scene has settled.
+        bool has_event = false;
+        bool waited = false;
+        if (idle_when_static && SDL_TICKS_PASSED(SDL_GetTicks(), redraw_until)) {
+            // Text fields blink their cursor, so keep waking up while one has focus.
+            has_event = SDL_WaitEventTimeout(&event, io.WantTextInput ? 250 : 1000);
+            waited = true;
+            if (!has_event && !io.WantTextInput)
+                continue;
+        }
+
+        TRACE_SCOPE("frame");
+
+        const auto counter = SDL_GetPerformanceCounter();
+        const auto elapsed = static_cast<float>(static_cast<double>(counter - prev_counter) / SDL_GetPerformanceFrequency());
+        prev_counter = counter;
+        if (!waited)
+            frame_times.add(elapsed * 1000.f);
 
         const auto front = get_camera_front(camera.pitch, camera.yaw);
         const auto up = glm::vec3(0.f, 1.f, 0.f);
         const auto right = glm::normalize(glm::cross(front, up));
-        const auto camera_pos = camera.origin - front * camera.distance;
 
-		while (SDL_PollEvent(&event)) {
+        cpu_timer_t stage_timer;
+
+		while (has_event || SDL_PollEvent(&event)) {
+            has_event = false;
+            // Any input may change the camera, settings or window, so keep drawing for a bit.
+            redraw_until = SDL_GetTicks() + settle_ms;
+            TRACE_SCOPE("handle event");
             ImGui_ImplSDL2_ProcessEvent(&event);
 
             const auto x_rel = static_cast<float>(event.motion.xrel);
@@ -422,52 +447,364 @@ int main(int argc, char** argv) {
 			}
 		}
 
+        event_times.add(stage_timer.restart());
+
 		glClearColor(background_color.x, background_color.y, background_color.z, 1.f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         const auto aspect_ratio = static_cast<float>(window_width) / window_height;
         const auto projection_mat = glm::perspective(glm::radians(65.0f), aspect_ratio, 0.1f, 1000.0f);
-        const auto view_mat = glm::lookAt(camera_pos, camera.origin, glm::vec3(0.f, 1.f, 0.f));
-        auto model_mat = glm::mat4(1.f);
-        model_mat = glm::scale(model_mat, glm::vec3(voxel_scale, voxel_scale, voxel_scale));
-
-        glUniformMatrix4fv(projection_uniform, 1, GL_FALSE, glm::value_ptr(projection_mat));
-        glUniformMatrix4fv(view_uniform, 1, GL_FALSE, glm::value_ptr(view_mat));
-        glUniformMatrix4fv(model_uniform, 1, GL_FALSE, glm::value_ptr(model_mat));
-
-        if (vertices)
-            glDrawElementsInstanced(GL_TRIANGLES, cube_mesh.indices.size(), GL_UNSIGNED_INT, 0, (*vertices).size());
+        const auto view_mat = get_camera_view_matrix(camera);
+        matrix_times.add(stage_timer.restart());
+
+        draw_stats = {};
+
+        // The sequence drives the point stream itself while playing.
+        if (sequence_player) {
+            if (sequence_player->update(elapsed, *pool)) {
+                const auto& frame = *sequence_player->displayed();
+                point_cloud = point_cloud_t {
+                    .layout = frame.layout,
+                    .count = frame.count,
+                    .position_offset = frame.position_offset,
+                    .position_extent = frame.position_extent,
+                    .octree = frame.octree,
+                    .uploaded = frame.count
+                };
+                renderer->bind_point_cloud(frame.vbo, frame.layout);
+
+                if (sequence_player->stats().shown == 1)
+                    camera.origin = glm::vec3(0.f, 0.f, frame.max_depth);
+            }
+        }
+        else if (point_stream.active() && point_cloud)
+            (*point_cloud).uploaded = point_stream.update(*pool);
+
+        // Sequences are always generated on the CPU.
+        const bool draw_reprojected = gpu_reprojection && renderer->texture_size() && !sequence_player;
+        const bool draw_vertices = (!gpu_reprojection || sequence_player) && point_cloud;
+
+        point_pass_timer.begin();
+        if (draw_reprojected || draw_vertices) {
+            const point_draw_settings_t draw_settings {
+                .projection = projection_mat,
+                .view = view_mat,
+                .viewport_height = static_cast<float>(window_height),
+                .render_mode = render_mode,
+                .splat_shape = splat_shape,
+                .voxel_scale = voxel_scale,
+                .frustum_culling = frustum_culling,
+                .level_of_detail = level_of_detail,
+                .lod_point_spacing = lod_point_spacing,
+                .lod_point_budget = static_cast<size_t>(lod_point_budget * 1e6f),
+                .stride = static_cast<unsigned int>(stride),
+                .intrinsics = ingest_intrinsics.value_or(intrinsics)
+            };
+            draw_stats = renderer->draw(draw_vertices ? &*point_cloud : nullptr, draw_settings);
+            if (draw_stats.cull_ms)
+                cull_times.add(*draw_stats.cull_ms);
+        }
+        point_pass_timer.end();
 
+        stage_timer.restart();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame();
         ImGui::NewFrame();
 
         ImGui::Begin("Window", &imgui_window_open);
         {
+            TRACE_SCOPE("build UI");
+
+            // Hand a finished background generation over for upload. The previous cloud stays
+            // up until this point.
+            if (generation_job && generation_job->finished()) {
+                auto result = generation_job->take_result();
+                const bool cancelled = generation_job->cancelled();
+                generation_job.reset();
+
+                if (!result) {
+                    if (!cancelled) {
+                        last_error_message = result.error();
+                        ImGui::OpenPopup("Error");
+                    }
+                }
+                else {
+                    const float max_depth = (*result).max_depth;
+
+                    if ((*result).images) {
+                        renderer->upload_depth_textures(*(*result).images);
+                    }
+                    else {
+                        point_cloud = upload_point_cloud(std::move(*result), point_cloud_vbo, point_stream);
+                        renderer->bind_point_cloud(point_cloud_vbo, (*point_cloud).layout);
+                    }
+
+                    // Set the center of the point cloud as our origin.
+                    if (recenter_camera)
+                        camera.origin = glm::vec3(0.f, 0.f, max_depth);
+                }
+            }
+
+            // Live frames go through the same generation path as files. Frames that arrive
+            // while one is generating replace each other, and are counted as dropped.
+            if (frame_listener && !generation_job && !sequence_player) {
+                if (auto frame = frame_listener->take_frame()) {
+                    // The wire format has no distortion, so frames are taken as already rectified.
+                    // Frames without intrinsics otherwise use the UI's, like files.
+                    auto frame_intrinsics = intrinsics;
+                    frame_intrinsics.k1 = frame_intrinsics.k2 = frame_intrinsics.k3 = 0.f;
+                    frame_intrinsics.p1 = frame_intrinsics.p2 = 0.f;
+                    if ((*frame).fx > 0.f) {
+                        frame_intrinsics.fx = (*frame).fx;
+                        frame_intrinsics.fy = (*frame).fy > 0.f ? (*frame).fy : (*frame).fx;
+                        frame_intrinsics.cx = (*frame).cx;
+                        frame_intrinsics.cy = (*frame).cy;
+                    }
+                    const generation_request_t request {
+                        .image_path = {},
+                        .depth_path = {},
+                        .intrinsics = frame_intrinsics,
+                        .stride = static_cast<unsigned int>(stride),
+                        .flying_pixel_threshold = remove_flying_pixels ? flying_pixel_threshold : 0.f,
+                        .voxel_size = use_voxel_grid ? voxel_grid_size : 0.f,
+                        .images_only = gpu_reprojection,
+                        .layout = compact_vertices ? vertex_layout_t::packed : vertex_layout_t::full,
+                        .cache_dir = {},
+                        .cache_byte_budget = 0,
+                        .image_cache = nullptr,
+                        .images = std::move((*frame).images)
+                    };
+                    generation_job = std::make_unique<generation_job_t>(request, *pool, wake_main_loop);
+                    recenter_camera = !ingest_centered;
+                    ingest_centered = true;
+                    ingest_intrinsics = (*frame).fx > 0.f ? std::optional(frame_intrinsics) : std::nullopt;
+                }
+            }
+
             if (ImGui::CollapsingHeader("Information"), ImGuiTreeNodeFlags_DefaultOpen) {
-                ImGui::Text("FPS: %.2f", fps);
-                if (vertices)
-                    ImGui::Text("Number of Vertices: %i", (*vertices).size());
+                const auto frame_stats = frame_times.stats();
+                if (frame_stats.avg > 0.f)
+                    ImGui::Text("FPS: %.2f", 1000.f / frame_stats.avg);
+                else
+                    ImGui::Text("FPS: -");
+                ImGui::Text("Depth Kernel: %s", depth_kernel_name(best_depth_kernel()));
+                ImGui::Text("Image Cache: %.1f MB", static_cast<double>(image_cache->bytes_used()) / (1 << 20));
+                if (draw_reprojected)
+                    ImGui::Text("Number of Vertices: %zu", get_depth_cloud_size((*renderer->texture_size()).x, (*renderer->texture_size()).y, stride));
+                else if (draw_vertices)
+                    ImGui::Text("Number of Vertices: %zu", (*point_cloud).count);
+                if (draw_vertices && (*point_cloud).uploaded < (*point_cloud).count)
+                    ImGui::Text("Uploaded Vertices: %zu (%s)", (*point_cloud).uploaded, point_stream.persistent() ? "persistent staging" : "mapped ranges");
+                if (draw_reprojected || draw_vertices) {
+                    ImGui::Text("Drawn Vertices: %zu", draw_stats.drawn_points);
+                    ImGui::Text("Draw Calls: %zu", draw_stats.draw_calls);
+                }
+                if (frame_listener) {
+                    const auto stats = frame_listener->stats();
+                    ImGui::Text("Ingest: %s, %zu received, %zu dropped", stats.connected ? "connected" : "waiting", stats.received, stats.dropped);
+                    // Frames the producer numbered but never sent, such as ones it couldn't compute in time.
+                    ImGui::Text("Skipped by Producer: %zu", stats.skipped);
+                }
+                if (sequence_player) {
+                    const auto& settings = sequence_player->settings();
+                    const auto& stats = sequence_player->stats();
+                    const auto passed = stats.shown + stats.dropped;
+                    ImGui::Text("Sequence Frame: %d / %d", sequence_player->position() + 1, settings.frame_count);
+                    ImGui::Text("Frames Shown: %zu, Dropped: %zu (%.1f%%)", stats.shown, stats.dropped,
+                        passed > 0 ? 100.0 * stats.dropped / passed : 0.0);
+                    ImGui::Text("Frames Buffered: %zu / %zu", sequence_player->buffered(), settings.ring_size - 1);
+                }
+
+                // GPU passes that take longer than the CPU stages mean the GPU is the limit. The
+                // point pass slowing with point count rather than window size means vertex-bound.
+                if (ImGui::TreeNode("Performance")) {
+                    const std::pair<const char*, const timing_history_t*> timings[] = {
+                        { "Frame", &frame_times },
+                        { "Events (CPU)", &event_times },
+                        { "Matrices (CPU)", &matrix_times },
+                        { "Culling/LOD (CPU)", &cull_times },
+                        { "UI Build (CPU)", &ui_times },
+                        { "Point Pass (GPU)", &point_pass_timer.history() },
+                        { "ImGui Pass (GPU)", &imgui_pass_timer.history() }
+                    };
+                    show_timings(timings);
+
+#if ZOE_TRACING
+                    // Chrome trace of the spans recorded in between, for chrome://tracing or Perfetto.
+                    ImGui::InputText("Trace File", trace_file_str, IM_ARRAYSIZE(trace_file_str));
+                    if (!trace_recording) {
+                        if (ImGui::Button("Record Trace"))
+                            start_trace();
+                    }
+                    else {
+                        if (ImGui::Button("Save Trace")) {
+                            if (auto spans = stop_trace(trace_file_str); !spans) {
+                                last_error_message = spans.error();
+                                ImGui::OpenPopup("Error");
+                            }
+                        }
+                        ImGui::SameLine();
+                        ImGui::Text("%zu spans", get_trace_span_count());
+                    }
+#endif
+                    ImGui::TreePop();
+                }
             }
 
             if (ImGui::CollapsingHeader("Generate"), ImGuiTreeNodeFlags_DefaultOpen) {
                 ImGui::InputText("Image File", image_file_str, IM_ARRAYSIZE(image_file_str));
                 ImGui::InputText("Depth Map File", depth_file_str, IM_ARRAYSIZE(depth_file_str));
-                ImGui::SliderFloat("Focal Length", &focal_length, 0.0f, 10000.0f, "%.1f");
+                ImGui::SliderFloat2("Focal Length (fx, fy)", &intrinsics.fx, 0.0f, 10000.0f, "%.1f");
+                // Negative uses the image center.
+                ImGui::InputFloat2("Principal Point (cx, cy)", &intrinsics.cx, "%.1f");
+                if (ImGui::TreeNode("Lens Distortion")) {
+                    // Brown-Conrady, as calibrated by OpenCV. Only applied when generating on the CPU.
+                    ImGui::InputFloat3("Radial (k1, k2, k3)", &intrinsics.k1, "%.5f");
+                    ImGui::InputFloat2("Tangential (p1, p2)", &intrinsics.p1, "%.5f");
+                    ImGui::TreePop();
+                }
                 ImGui::SliderInt("Stride", &stride, 1, 10);
+                // Drops the streaks of points between foreground and background. Not applied by GPU reprojection.
+                ImGui::Checkbox("Remove Flying Pixels", &remove_flying_pixels);
+                ImGui::BeginDisabled(!remove_flying_pixels);
+                ImGui::SliderFloat("Depth Jump Threshold", &flying_pixel_threshold, .01f, .5f, "%.2f");
+                ImGui::EndDisabled();
+                // One averaged point per grid cell, so near surfaces thin out as much as far ones. Not applied by GPU reprojection.
+                ImGui::Checkbox("Voxel Grid", &use_voxel_grid);
+                ImGui::BeginDisabled(!use_voxel_grid);
+                ImGui::SliderFloat("Cell Size", &voxel_grid_size, .001f, .5f, "%.3f m", ImGuiSliderFlags_Logarithmic);
+                ImGui::EndDisabled();
+                // Reprojects in the vertex shader, so focal length and stride changes apply immediately.
+                ImGui::Checkbox("GPU Reprojection", &gpu_reprojection);
+                // 16-bit positions and 8-bit colors, half the VRAM of full floats.
+                ImGui::Checkbox("Compact Vertices", &compact_vertices);
+                // Reuses the last cloud generated from the same files and parameters. Sequence frames are never cached.
+                ImGui::Checkbox("Cache Clouds", &cache_clouds);
+
+                if (generation_job) {
+                    ImGui::ProgressBar(generation_job->progress(), ImVec2(-FLT_MIN, 0.f), generation_stage_name(generation_job->stage()));
+                    ImGui::BeginDisabled(generation_job->cancelled());
+                    if (ImGui::Button("Cancel##2"))
+                        generation_job->cancel();
+                    ImGui::EndDisabled();
+                }
+                else {
+                    // A finished generation would replace the sequence's frames.
+                    ImGui::BeginDisabled(sequence_player != nullptr);
+                    if (ImGui::Button("Generate##2")) {
+                        const generation_request_t request {
+                            .image_path = image_file_str,
+                            .depth_path = depth_file_str,
+                            .intrinsics = intrinsics,
+                            .stride = static_cast<unsigned int>(stride),
+                            .flying_pixel_threshold = remove_flying_pixels ? flying_pixel_threshold : 0.f,
+                            .voxel_size = use_voxel_grid ? voxel_grid_size : 0.f,
+                            .images_only = gpu_reprojection,
+                            .layout = compact_vertices ? vertex_layout_t::packed : vertex_layout_t::full,
+                            .cache_dir = cache_clouds ? cloud_cache_dir : std::filesystem::path(),
+                            .cache_byte_budget = static_cast<uint64_t>(cloud_cache_mb) << 20,
+                            .image_cache = image_cache,
+                            .images = nullptr
+                        };
+                        generation_job = std::make_unique<generation_job_t>(request, *pool, wake_main_loop);
+                        recenter_camera = true;
+                        ingest_intrinsics = std::nullopt;
+                    }
+                    ImGui::EndDisabled();
+                }
+            }
 
-                if (ImGui::Button("Generate##2")) {
-                    const auto result = generate_depth_cloud(image_file_str, depth_file_str, focal_length, stride);
-                    if (!result) {
-                        last_error_message = result.error();
-                        ImGui::OpenPopup("Error");
+            if (ImGui::CollapsingHeader("Sequence", ImGuiTreeNodeFlags_DefaultOpen)) {
+                // Numbered frames such as frames/rgb_%04d.png, generated with the settings above.
+                ImGui::InputText("Image Pattern", image_pattern_str, IM_ARRAYSIZE(image_pattern_str));
+                ImGui::InputText("Depth Map Pattern", depth_pattern_str, IM_ARRAYSIZE(depth_pattern_str));
+
+                if (!sequence_player) {
+                    if (ImGui::InputInt("First Frame", &sequence_first_frame))
+                        sequence_first_frame = std::max(0, sequence_first_frame);
+                    ImGui::SliderFloat("Target FPS", &sequence_fps, 1.f, 120.f, "%.1f");
+                    // Frames generated ahead and held in VRAM, including the one on screen.
+                    ImGui::SliderInt("Ring Size", &sequence_ring_size, 2, 32);
+                    ImGui::Checkbox("Loop", &sequence_loop);
+
+                    // Wait for the single cloud to finish, so it can be put back afterwards.
+                    ImGui::BeginDisabled(generation_job != nullptr || point_stream.active());
+                    if (ImGui::Button("Play Sequence")) {
+                        const auto frame_count = count_sequence_frames(image_pattern_str, depth_pattern_str, sequence_first_frame);
+                        if (!frame_count) {
+                            last_error_message = frame_count.error();
+                            ImGui::OpenPopup("Error");
+                        }
+                        else {
+                            const sequence_settings_t settings {
+                                .image_pattern = image_pattern_str,
+                                .depth_pattern = depth_pattern_str,
+                                .first_frame = sequence_first_frame,
+                                .frame_count = *frame_count,
+                                .target_fps = sequence_fps,
+                                .loop = sequence_loop,
+                                .ring_size = static_cast<size_t>(sequence_ring_size),
+                                .intrinsics = intrinsics,
+                                .stride = static_cast<unsigned int>(stride),
+                                .flying_pixel_threshold = remove_flying_pixels ? flying_pixel_threshold : 0.f,
+                                .voxel_size = use_voxel_grid ? voxel_grid_size : 0.f,
+                                .layout = compact_vertices ? vertex_layout_t::packed : vertex_layout_t::full
+                            };
+                            single_point_cloud = std::move(point_cloud);
+                            point_cloud = std::nullopt;
+                            sequence_player = std::make_unique<sequence_player_t>(settings, point_stream, wake_main_loop);
+                        }
                     }
-                    else {
-                        vertices = (*result).vertices;
-                        // Set the center of the point cloud as our origin.
-                        camera.origin = glm::vec3(0.f, 0.f, (*result).max_depth);
-                        glBufferData(GL_ARRAY_BUFFER, (*vertices).size() * sizeof(vertex_t), (*vertices).data(), GL_STATIC_DRAW);
+                    ImGui::EndDisabled();
+                }
+                else {
+                    int position = sequence_player->position();
+                    if (ImGui::SliderInt("Frame", &position, 0, sequence_player->settings().frame_count - 1))
+                        sequence_player->seek(position);
+
+                    if (ImGui::Button(sequence_player->playing() ? "Pause" : "Play"))
+                        sequence_player->set_playing(!sequence_player->playing());
+                    ImGui::SameLine();
+                    if (ImGui::Button("Stop")) {
+                        sequence_player.reset();
+                        point_cloud = std::move(single_point_cloud);
+                        single_point_cloud = std::nullopt;
+                        renderer->bind_point_cloud(point_cloud_vbo, point_cloud ? (*point_cloud).layout : vertex_layout_t::full);
+                    }
+                    else if (!sequence_player->last_error().empty())
+                        ImGui::TextWrapped("Last Error: %s", sequence_player->last_error().c_str());
+                }
+            }
+
+            if (ImGui::CollapsingHeader("Ingest", ImGuiTreeNodeFlags_DefaultOpen)) {
+                // Raw frames from a local process such as tools/frame_replay, generated with the
+                // settings above.
+                ImGui::BeginDisabled(frame_listener != nullptr);
+                ImGui::InputText("Socket Path", socket_path_str, IM_ARRAYSIZE(socket_path_str));
+                ImGui::EndDisabled();
+
+                if (!frame_listener) {
+                    if (ImGui::Button("Listen")) {
+                        auto listener = frame_listener_t::listen(socket_path_str, wake_main_loop);
+                        if (!listener) {
+                            last_error_message = listener.error();
+                            ImGui::OpenPopup("Error");
+                        }
+                        else {
+                            frame_listener = std::move(*listener);
+                            ingest_centered = false;
+                        }
+                    }
+                }
+                else {
+                    if (ingest_intrinsics)
+                        ImGui::Text("Frame Intrinsics: fx %.1f, fy %.1f, cx %.1f, cy %.1f", (*ingest_intrinsics).fx, (*ingest_intrinsics).fy, (*ingest_intrinsics).cx, (*ingest_intrinsics).cy);
+                    if (ImGui::Button("Stop Listening")) {
+                        frame_listener.reset();
+                        ingest_intrinsics = std::nullopt;
                     }
+                    else if (const auto error = frame_listener->last_error(); !error.empty())
+                        ImGui::TextWrapped("Last Error: %s", error.c_str());
                 }
             }
 
@@ -476,6 +813,43 @@ int main(int argc, char** argv) {
                 ImGui::SetNextItemWidth(-FLT_MIN);
                 ImGui::ColorPicker3("Background Color", &background_color.x);
                 ImGui::SliderFloat("Voxel Scale", &voxel_scale, 0.00001f, .01f, "%.4f");
+
+                const char* render_modes[] = { "Cube", "Sprite" };
+                int render_mode_index = static_cast<int>(render_mode);
+                if (ImGui::Combo("Render Mode", &render_mode_index, render_modes, IM_ARRAYSIZE(render_modes)))
+                    render_mode = static_cast<render_mode_t>(render_mode_index);
+
+                if (render_mode == render_mode_t::sprite) {
+                    const char* splat_shapes[] = { "Square", "Round" };
+                    int splat_shape_index = static_cast<int>(splat_shape);
+                    if (ImGui::Combo("Splat Shape", &splat_shape_index, splat_shapes, IM_ARRAYSIZE(splat_shapes)))
+                        splat_shape = static_cast<splat_shape_t>(splat_shape_index);
+                }
+
+                // Only redraws after input instead of every frame, to save power on a static scene.
+                ImGui::Checkbox("Idle When Static", &idle_when_static);
+                // Skips octree nodes outside the view. Octree options apply to generated clouds, not GPU reprojection.
+                ImGui::Checkbox("Frustum Culling", &frustum_culling);
+                // Draws coarser octree levels where points would be denser than the target spacing.
+                ImGui::Checkbox("Level of Detail", &level_of_detail);
+                if (level_of_detail) {
+                    ImGui::SliderFloat("LOD Point Spacing (px)", &lod_point_spacing, .25f, 8.f, "%.2f");
+                    ImGui::SliderFloat("LOD Point Budget (M)", &lod_point_budget, .1f, 50.f, "%.1f");
+                }
+                // The pool can't be replaced while a generation, cache write or sequence is running on
+                // it, as the old pool's destructor would wait for it on the render thread.
+                ImGui::BeginDisabled(generation_job != nullptr || pending_cloud_cache_writes() > 0 || sequence_player != nullptr);
+                ImGui::SliderInt("Worker Threads", &worker_threads, 1, thread_pool_t::default_thread_count());
+                // Only rebuild the pool once the slider is released.
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                    pool = std::make_unique<thread_pool_t>(worker_threads);
+                ImGui::EndDisabled();
+                if (ImGui::SliderInt("Image Cache (MB)", &image_cache_mb, 0, 8192))
+                    image_cache->set_byte_budget(static_cast<size_t>(image_cache_mb) << 20);
+                ImGui::SliderInt("Cloud Cache (MB)", &cloud_cache_mb, 256, 65536, "%d", ImGuiSliderFlags_Logarithmic);
+                // Generations trim to the budget after every write, so only a lowered one needs applying here.
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                    trim_cloud_cache(cloud_cache_dir, static_cast<uint64_t>(cloud_cache_mb) << 20);
             }
         }
 
@@ -489,11 +863,27 @@ int main(int argc, char** argv) {
 
         ImGui::End();
         ImGui::Render();
+        ui_times.add(stage_timer.restart());
+
+        imgui_pass_timer.begin();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        imgui_pass_timer.end();
 
-		SDL_GL_SwapWindow(window);
+        {
+            // Includes waiting for vsync.
+            TRACE_SCOPE("swap");
+            SDL_GL_SwapWindow(window);
+        }
 	}
 
+    // Don't keep generating into a pool that is about to be torn down.
+    if (generation_job)
+        generation_job->cancel();
+    sequence_player.reset();
+
+    if (!trace_path.empty())
+        save_trace(trace_path);
+
 	// TODO: Cleanup
     return EXIT_SUCCESS;
 }
\ No newline at end of file
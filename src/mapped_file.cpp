@@ -0,0 +1,122 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file_t::~mapped_file_t() {
+    close();
+}
+
+mapped_file_t::mapped_file_t(mapped_file_t&& other) noexcept {
+    *this = std::move(other);
+}
+
+mapped_file_t& mapped_file_t::operator=(mapped_file_t&& other) noexcept {
+    if (this != &other) {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+#ifdef _WIN32
+        file_handle = std::exchange(other.file_handle, nullptr);
+        mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+std::expected<mapped_file_t, std::string> mapped_file_t::open(const std::filesystem::path& path) {
+    mapped_file_t file;
+
+    file.file_handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file.file_handle == INVALID_HANDLE_VALUE) {
+        file.file_handle = nullptr;
+        return std::unexpected("Failed to open " + path.string() + ".");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file.file_handle, &size))
+        return std::unexpected("Failed to get the size of " + path.string() + ".");
+
+    // Empty files can't be mapped, but are valid.
+    if (size.QuadPart == 0)
+        return file;
+
+    file.mapping_handle = CreateFileMappingW(file.file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file.mapping_handle)
+        return std::unexpected("Failed to map " + path.string() + ".");
+
+    file.data = static_cast<const std::byte*>(MapViewOfFile(file.mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!file.data)
+        return std::unexpected("Failed to map " + path.string() + ".");
+
+    file.size = static_cast<size_t>(size.QuadPart);
+    return file;
+}
+
+void mapped_file_t::close() {
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+
+    data = nullptr;
+    size = 0;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+
+#else
+
+std::expected<mapped_file_t, std::string> mapped_file_t::open(const std::filesystem::path& path) {
+    mapped_file_t file;
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return std::unexpected("Failed to open " + path.string() + ".");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return std::unexpected("Failed to get the size of " + path.string() + ".");
+    }
+
+    // Empty files can't be mapped, but are valid.
+    if (info.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return std::unexpected("Failed to map " + path.string() + ".");
+        }
+
+        file.data = static_cast<const std::byte*>(data);
+        file.size = static_cast<size_t>(info.st_size);
+    }
+
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    return file;
+}
+
+void mapped_file_t::close() {
+    if (data)
+        munmap(const_cast<std::byte*>(data), size);
+
+    data = nullptr;
+    size = 0;
+}
+
+#endif
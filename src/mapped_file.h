@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are faulted in on first touch, so opening
+// is cheap no matter how large the file is.
+class mapped_file_t {
+public:
+    mapped_file_t() = default;
+    ~mapped_file_t();
+
+    mapped_file_t(mapped_file_t&& other) noexcept;
+    mapped_file_t& operator=(mapped_file_t&& other) noexcept;
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+    static std::expected<mapped_file_t, std::string> open(const std::filesystem::path& path);
+
+    std::span<const std::byte> bytes() const { return { data, size }; }
+
+private:
+    void close();
+
+    const std::byte* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
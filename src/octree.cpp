@@ -0,0 +1,471 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <queue>
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+// Nodes with this many points or fewer are not split further.
+constexpr uint32_t max_leaf_points = 16384;
+// Each node keeps a sample of one point per cell of a 2^lod_grid_bits grid over itself.
+constexpr int lod_grid_bits = 5;
+// Morton codes hold 10 bits per axis, which is also the deepest a node can be.
+constexpr int max_depth = 10;
+constexpr uint32_t grid_size = 1u << max_depth;
+
+// Spreads the low 10 bits of v out so there are two zero bits between each.
+uint32_t spread_bits(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Sorts by the Morton code in the upper 32 bits, 10 bits per pass.
+void radix_sort_keys(std::vector<uint64_t>& keys) {
+    std::vector<uint64_t> scratch(keys.size());
+
+    for (int shift = 32; shift < 32 + max_depth * 3; shift += 10) {
+        std::array<size_t, 1024> offsets {};
+        for (const auto key : keys)
+            offsets[(key >> shift) & 1023]++;
+
+        size_t total = 0;
+        for (auto& offset : offsets) {
+            const auto bucket_count = offset;
+            offset = total;
+            total += bucket_count;
+        }
+
+        for (const auto key : keys)
+            scratch[offsets[(key >> shift) & 1023]++] = key;
+
+        keys.swap(scratch);
+    }
+}
+
+// Lays out the subtree of a node depth first: the node's own sample, then each child's subtree.
+class octree_builder_t {
+public:
+    octree_builder_t(const std::vector<uint64_t>& keys, std::vector<octree_node_t>& nodes)
+        : keys(keys), nodes(nodes), taken(keys.size(), 0) {
+        order.reserve(keys.size());
+    }
+
+    // Fills in nodes[node_index], whose bounds are already set, from sorted keys [begin, end).
+    void build(uint32_t node_index, size_t begin, size_t end, int depth) {
+        const auto first = static_cast<uint32_t>(order.size());
+
+        size_t remaining = 0;
+        for (size_t i = begin; i < end; i++)
+            remaining += !taken[i];
+
+        if (remaining <= max_leaf_points || depth == max_depth) {
+            for (size_t i = begin; i < end; i++) {
+                if (!taken[i])
+                    take(i);
+            }
+            set_range(node_index, first);
+            return;
+        }
+
+        // One point per cell of a lod_grid^3 grid over the node, which is the first untaken
+        // point of each run of equal Morton prefixes since the keys are sorted.
+        const int sample_depth = std::min(depth + lod_grid_bits, max_depth);
+        const int sample_shift = 32 + 3 * (max_depth - sample_depth);
+        for (size_t i = begin; i < end;) {
+            const auto cell = keys[i] >> sample_shift;
+            size_t cell_end = i;
+            bool sampled = false;
+            for (; cell_end < end && (keys[cell_end] >> sample_shift) == cell; cell_end++) {
+                if (!sampled && !taken[cell_end]) {
+                    take(cell_end);
+                    sampled = true;
+                }
+            }
+            i = cell_end;
+        }
+        nodes[node_index].own_count = static_cast<uint32_t>(order.size()) - first;
+
+        // Points in a node share every Morton digit above this one, so the children are
+        // consecutive runs of the same digit.
+        const int shift = 32 + 3 * (max_depth - 1 - depth);
+        struct child_range_t { size_t begin, end; uint64_t digit; };
+        std::array<child_range_t, 8> children;
+        uint32_t child_count = 0;
+
+        auto child_begin = begin;
+        for (uint64_t digit = 0; digit < 8 && child_begin != end; digit++) {
+            const auto child_end = static_cast<size_t>(std::partition_point(
+                keys.begin() + child_begin, keys.begin() + end,
+                [&](uint64_t key) { return ((key >> shift) & 7) <= digit; }
+            ) - keys.begin());
+
+            // Children whose points were all sampled by an ancestor are dropped.
+            const bool has_remaining = std::any_of(taken.begin() + child_begin, taken.begin() + child_end, [](uint8_t t) { return !t; });
+            if (has_remaining)
+                children[child_count++] = child_range_t { child_begin, child_end, digit };
+
+            child_begin = child_end;
+        }
+
+        // Children get one contiguous block of node slots before any of them are built.
+        const auto node = nodes[node_index];
+        const auto half = (node.bounds_max - node.bounds_min) * .5f;
+        const auto first_child = static_cast<uint32_t>(nodes.size());
+        nodes[node_index].first_child = first_child;
+        nodes[node_index].child_count = child_count;
+
+        for (uint32_t child = 0; child < child_count; child++) {
+            const auto digit = children[child].digit;
+            const auto child_min = node.bounds_min + half * glm::vec3(
+                static_cast<float>(digit & 1),
+                static_cast<float>((digit >> 1) & 1),
+                static_cast<float>((digit >> 2) & 1)
+            );
+            nodes.push_back(octree_node_t {
+                .bounds_min = child_min,
+                .bounds_max = child_min + half,
+                .first = 0,
+                .own_count = 0,
+                .count = 0,
+                .first_child = 0,
+                .child_count = 0
+            });
+        }
+
+        for (uint32_t child = 0; child < child_count; child++)
+            build(first_child + child, children[child].begin, children[child].end, depth + 1);
+
+        nodes[node_index].first = first;
+        nodes[node_index].count = static_cast<uint32_t>(order.size()) - first;
+    }
+
+    // Original vertex index for every position in the new layout.
+    std::vector<uint32_t> order;
+
+private:
+    void take(size_t i) {
+        taken[i] = 1;
+        order.push_back(static_cast<uint32_t>(keys[i]));
+    }
+
+    void set_range(uint32_t node_index, uint32_t first) {
+        auto& node = nodes[node_index];
+        node.first = first;
+        node.own_count = static_cast<uint32_t>(order.size()) - first;
+        node.count = node.own_count;
+    }
+
+    const std::vector<uint64_t>& keys;
+    std::vector<octree_node_t>& nodes;
+    std::vector<uint8_t> taken;
+};
+
+template <typename Vertex, typename GetPosition>
+point_octree_t build_octree(
+    const std::vector<Vertex>& vertices,
+    GetPosition&& get_position,
+    std::vector<uint32_t>& order,
+    thread_pool_t& pool
+) {
+    point_octree_t octree;
+    order.clear();
+    const size_t count = vertices.size();
+    if (count == 0)
+        return octree;
+
+    const size_t band_count = std::min<size_t>(count, pool.thread_count() * 4);
+    const size_t band_size = (count + band_count - 1) / band_count;
+
+    std::vector<glm::vec3> band_mins(band_count, glm::vec3(FLT_MAX));
+    std::vector<glm::vec3> band_maxs(band_count, glm::vec3(-FLT_MAX));
+    pool.parallel_for(band_count, [&](size_t band) {
+        const size_t end = std::min(count, (band + 1) * band_size);
+        for (size_t i = band * band_size; i < end; i++) {
+            const auto position = get_position(vertices[i]);
+            band_mins[band] = glm::min(band_mins[band], position);
+            band_maxs[band] = glm::max(band_maxs[band], position);
+        }
+    });
+
+    auto bounds_min = glm::vec3(FLT_MAX);
+    auto bounds_max = glm::vec3(-FLT_MAX);
+    for (size_t band = 0; band < band_count; band++) {
+        bounds_min = glm::min(bounds_min, band_mins[band]);
+        bounds_max = glm::max(bounds_max, band_maxs[band]);
+    }
+
+    // The root is a cube so every cell below it is too.
+    const auto size = bounds_max - bounds_min;
+    float edge = std::max({ size.x, size.y, size.z });
+    if (edge <= 0.f)
+        edge = 1.f;
+    const float to_grid = static_cast<float>(grid_size) / edge;
+
+    // Morton code in the upper half, original index in the lower half.
+    std::vector<uint64_t> keys(count);
+    pool.parallel_for(band_count, [&](size_t band) {
+        const size_t end = std::min(count, (band + 1) * band_size);
+        for (size_t i = band * band_size; i < end; i++) {
+            const auto cell = (get_position(vertices[i]) - bounds_min) * to_grid;
+            const auto x = std::min(static_cast<uint32_t>(cell.x), grid_size - 1);
+            const auto y = std::min(static_cast<uint32_t>(cell.y), grid_size - 1);
+            const auto z = std::min(static_cast<uint32_t>(cell.z), grid_size - 1);
+            const uint32_t code = spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+            keys[i] = (static_cast<uint64_t>(code) << 32) | i;
+        }
+    });
+
+    radix_sort_keys(keys);
+
+    octree.nodes.push_back(octree_node_t {
+        .bounds_min = bounds_min,
+        .bounds_max = bounds_min + glm::vec3(edge),
+        .first = 0,
+        .own_count = 0,
+        .count = 0,
+        .first_child = 0,
+        .child_count = 0
+    });
+
+    octree_builder_t builder(keys, octree.nodes);
+    builder.build(0, 0, count, 0);
+    order = std::move(builder.order);
+
+    return octree;
+}
+
+template <typename Vertex>
+void gather(
+    const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& order,
+    size_t first,
+    size_t count,
+    Vertex* out,
+    thread_pool_t& pool
+) {
+    if (count == 0)
+        return;
+
+    const size_t band_count = std::min<size_t>(count, pool.thread_count() * 4);
+    const size_t band_size = (count + band_count - 1) / band_count;
+    pool.parallel_for(band_count, [&](size_t band) {
+        const size_t end = std::min(count, (band + 1) * band_size);
+        for (size_t i = band * band_size; i < end; i++)
+            out[i] = vertices[order[first + i]];
+    });
+}
+
+// Projected size in pixels of a node's sample spacing, from its nearest possible depth.
+float get_node_spacing_pixels(const octree_node_t& node, const glm::mat4& clip_matrix, float pixels_per_unit) {
+    const auto center = (node.bounds_min + node.bounds_max) * .5f;
+    const float radius = glm::length(node.bounds_max - center);
+    const float w = (clip_matrix * glm::vec4(center, 1.f)).w - radius;
+
+    // The camera is inside or right next to the node, so it always needs refining.
+    if (w <= 1e-4f)
+        return FLT_MAX;
+
+    const float spacing = (node.bounds_max.x - node.bounds_min.x) / static_cast<float>(1 << lod_grid_bits);
+    return spacing * pixels_per_unit / w;
+}
+
+enum class frustum_test_t {
+    outside,
+    intersecting,
+    inside
+};
+
+using frustum_t = std::array<glm::vec4, 6>;
+
+// Planes of the clip volume, -w <= x, y, z <= w, in the space clip_matrix transforms from.
+frustum_t get_frustum(const glm::mat4& clip_matrix) {
+    frustum_t planes;
+    for (int axis = 0; axis < 3; axis++) {
+        const auto row = glm::vec4(clip_matrix[0][axis], clip_matrix[1][axis], clip_matrix[2][axis], clip_matrix[3][axis]);
+        const auto w_row = glm::vec4(clip_matrix[0][3], clip_matrix[1][3], clip_matrix[2][3], clip_matrix[3][3]);
+        planes[axis * 2] = w_row + row;
+        planes[axis * 2 + 1] = w_row - row;
+    }
+    return planes;
+}
+
+frustum_test_t test_frustum(const frustum_t& planes, const octree_node_t& node, float margin) {
+    const auto node_min = node.bounds_min - glm::vec3(margin);
+    const auto node_max = node.bounds_max + glm::vec3(margin);
+
+    auto result = frustum_test_t::inside;
+    for (const auto& plane : planes) {
+        // The corners furthest along and against the plane normal.
+        const auto far_corner = glm::vec3(
+            plane.x >= 0.f ? node_max.x : node_min.x,
+            plane.y >= 0.f ? node_max.y : node_min.y,
+            plane.z >= 0.f ? node_max.z : node_min.z
+        );
+        const auto near_corner = glm::vec3(
+            plane.x >= 0.f ? node_min.x : node_max.x,
+            plane.y >= 0.f ? node_min.y : node_max.y,
+            plane.z >= 0.f ? node_min.z : node_max.z
+        );
+
+        if (glm::dot(glm::vec3(plane), far_corner) + plane.w < 0.f)
+            return frustum_test_t::outside;
+        if (glm::dot(glm::vec3(plane), near_corner) + plane.w < 0.f)
+            result = frustum_test_t::intersecting;
+    }
+    return result;
+}
+
+void push_range(std::vector<draw_range_t>& ranges, uint32_t first, uint32_t count) {
+    if (count == 0)
+        return;
+
+    if (!ranges.empty() && ranges.back().first + ranges.back().count == first)
+        ranges.back().count += count;
+    else
+        ranges.push_back(draw_range_t { first, count });
+}
+
+}
+
+point_octree_t build_point_octree(const std::vector<vertex_t>& vertices, std::vector<uint32_t>& order, thread_pool_t& pool) {
+    TRACE_SCOPE("build octree");
+    return build_octree(vertices, [](const vertex_t& vertex) { return vertex.position; }, order, pool);
+}
+
+point_octree_t build_point_octree(
+    const std::vector<packed_vertex_t>& vertices,
+    const glm::vec3& position_offset,
+    const glm::vec3& position_extent,
+    std::vector<uint32_t>& order,
+    thread_pool_t& pool
+) {
+    TRACE_SCOPE("build octree");
+    const auto scale = position_extent / 65535.f;
+    return build_octree(vertices, [&](const packed_vertex_t& vertex) {
+        return position_offset + glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) * scale;
+    }, order, pool);
+}
+
+void gather_points(
+    const std::vector<vertex_t>& vertices,
+    const std::vector<uint32_t>& order,
+    size_t first,
+    size_t count,
+    vertex_t* out,
+    thread_pool_t& pool
+) {
+    gather(vertices, order, first, count, out, pool);
+}
+
+void gather_points(
+    const std::vector<packed_vertex_t>& vertices,
+    const std::vector<uint32_t>& order,
+    size_t first,
+    size_t count,
+    packed_vertex_t* out,
+    thread_pool_t& pool
+) {
+    gather(vertices, order, first, count, out, pool);
+}
+
+void cull_point_octree(
+    const point_octree_t& octree,
+    const glm::mat4& clip_matrix,
+    float margin,
+    std::vector<draw_range_t>& ranges
+) {
+    if (octree.nodes.empty())
+        return;
+
+    const auto planes = get_frustum(clip_matrix);
+
+    std::vector<uint32_t> stack = { 0 };
+    while (!stack.empty()) {
+        const auto& node = octree.nodes[stack.back()];
+        stack.pop_back();
+
+        const auto test = test_frustum(planes, node, margin);
+        if (test == frustum_test_t::outside)
+            continue;
+
+        // Nodes are visited in buffer order, so touching ranges can be merged as we go.
+        if (test == frustum_test_t::inside) {
+            push_range(ranges, node.first, node.count);
+            continue;
+        }
+
+        push_range(ranges, node.first, node.own_count);
+
+        // Pushed in reverse so children pop in buffer order.
+        for (uint32_t child = node.child_count; child > 0; child--)
+            stack.push_back(node.first_child + child - 1);
+    }
+}
+
+size_t select_point_octree_lod(
+    const point_octree_t& octree,
+    const glm::mat4& clip_matrix,
+    float margin,
+    const lod_settings_t& settings,
+    std::vector<draw_range_t>& ranges
+) {
+    if (octree.nodes.empty())
+        return 0;
+
+    const auto planes = get_frustum(clip_matrix);
+
+    // Coarsest-looking nodes first, so the budget is spent where it is most visible.
+    struct candidate_t {
+        float spacing_pixels;
+        uint32_t node;
+        bool operator<(const candidate_t& other) const { return spacing_pixels < other.spacing_pixels; }
+    };
+    std::priority_queue<candidate_t> queue;
+    queue.push(candidate_t { FLT_MAX, 0 });
+
+    const size_t first_range = ranges.size();
+    size_t selected = 0;
+
+    while (!queue.empty() && selected < settings.point_budget) {
+        const auto candidate = queue.top();
+        queue.pop();
+        const auto& node = octree.nodes[candidate.node];
+
+        if (test_frustum(planes, node, margin) == frustum_test_t::outside)
+            continue;
+
+        const auto own_count = static_cast<uint32_t>(std::min<size_t>(node.own_count, settings.point_budget - selected));
+        ranges.push_back(draw_range_t { node.first, own_count });
+        selected += own_count;
+
+        // Children only add detail once this node's own sample is sparser than the target.
+        if (get_node_spacing_pixels(node, clip_matrix, settings.pixels_per_unit) <= settings.target_spacing)
+            continue;
+
+        for (uint32_t child = 0; child < node.child_count; child++) {
+            const auto child_index = node.first_child + child;
+            const float spacing_pixels = get_node_spacing_pixels(octree.nodes[child_index], clip_matrix, settings.pixels_per_unit);
+            queue.push(candidate_t { spacing_pixels, child_index });
+        }
+    }
+
+    // Selected out of order, so sort back into buffer order before merging touching ranges.
+    std::sort(ranges.begin() + first_range, ranges.end(), [](const draw_range_t& a, const draw_range_t& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<draw_range_t> selected_ranges(ranges.begin() + first_range, ranges.end());
+    ranges.resize(first_range);
+    for (const auto& range : selected_ranges)
+        push_range(ranges, range.first, range.count);
+
+    return selected;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+
+class thread_pool_t;
+
+struct octree_node_t {
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    // Range of points in the reordered vertex buffer covering the whole subtree. The first
+    // own_count of them are the node's own spatially uniform sample, followed by each
+    // child's subtree. A leaf owns all of its points.
+    uint32_t first;
+    uint32_t own_count;
+    uint32_t count;
+    // Children are stored next to each other. child_count is 0 for leaves.
+    uint32_t first_child;
+    uint32_t child_count;
+};
+
+// Octree over a point cloud whose vertices have been reordered so every subtree covers one
+// contiguous range, which lets visible nodes be drawn straight out of the VBO. Each level
+// is a uniform subsample of the detail below it, so nodes double as levels of detail.
+struct point_octree_t {
+    // nodes[0] is the root.
+    std::vector<octree_node_t> nodes;
+};
+
+// A contiguous range of points to draw.
+struct draw_range_t {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct lod_settings_t {
+    // Converts a length at unit clip-space w into pixels, projection[1][1] * viewport height / 2.
+    float pixels_per_unit;
+    // Nodes are refined until their sample spacing projects to at most this many pixels.
+    float target_spacing;
+    // Stop selecting once this many points have been chosen.
+    size_t point_budget;
+};
+
+// Builds the octree over the vertices and fills order with the vertex index for every
+// position of the octree layout. The vertices themselves are left alone, so the reordered
+// copy can be gathered straight into its destination with gather_points.
+point_octree_t build_point_octree(const std::vector<vertex_t>& vertices, std::vector<uint32_t>& order, thread_pool_t& pool);
+// Packed positions are dequantized with the same offset and extent the shader uses.
+point_octree_t build_point_octree(
+    const std::vector<packed_vertex_t>& vertices,
+    const glm::vec3& position_offset,
+    const glm::vec3& position_extent,
+    std::vector<uint32_t>& order,
+    thread_pool_t& pool
+);
+
+// Writes vertices[order[first + i]] to out[i] for count points.
+void gather_points(
+    const std::vector<vertex_t>& vertices,
+    const std::vector<uint32_t>& order,
+    size_t first,
+    size_t count,
+    vertex_t* out,
+    thread_pool_t& pool
+);
+void gather_points(
+    const std::vector<packed_vertex_t>& vertices,
+    const std::vector<uint32_t>& order,
+    size_t first,
+    size_t count,
+    packed_vertex_t* out,
+    thread_pool_t& pool
+);
+
+// Appends the ranges of points whose node intersects the frustum of clip_matrix, merging
+// ranges that touch. Node bounds are grown by margin to account for the size of each point.
+void cull_point_octree(
+    const point_octree_t& octree,
+    const glm::mat4& clip_matrix,
+    float margin,
+    std::vector<draw_range_t>& ranges
+);
+
+// Like cull_point_octree, but only refines nodes whose sample spacing is larger than the
+// target on screen, most visible first, until the point budget runs out. Returns the
+// number of points selected.
+size_t select_point_octree_lod(
+    const point_octree_t& octree,
+    const glm::mat4& clip_matrix,
+    float margin,
+    const lod_settings_t& settings,
+    std::vector<draw_range_t>& ranges
+);
@@ -0,0 +1,57 @@
+#include "ply.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+// Bytes per point: 3 floats and 3 uchars, unpadded.
+static constexpr size_t ply_point_size = 3 * sizeof(float) + 3;
+// Points converted per write, to keep the staging buffer small.
+static constexpr size_t ply_chunk_points = 64 * 1024;
+
+static uint8_t to_color_byte(float value) {
+    return static_cast<uint8_t>(std::clamp(value * 255.f + .5f, 0.f, 255.f));
+}
+
+std::expected<void, std::string> write_ply(const std::filesystem::path& path, const std::vector<vertex_t>& vertices) {
+    static_assert(std::endian::native == std::endian::little, "PLY output assumes a little endian host.");
+
+    std::ofstream ofs(path, std::ios::binary);
+    if (ofs.fail())
+        return std::unexpected("Failed to open " + path.string() + " for writing.");
+
+    ofs << "ply\n"
+        << "format binary_little_endian 1.0\n"
+        << "element vertex " << vertices.size() << "\n"
+        << "property float x\n"
+        << "property float y\n"
+        << "property float z\n"
+        << "property uchar red\n"
+        << "property uchar green\n"
+        << "property uchar blue\n"
+        << "end_header\n";
+
+    std::vector<char> buffer(std::min(vertices.size(), ply_chunk_points) * ply_point_size);
+
+    for (size_t first = 0; first < vertices.size(); first += ply_chunk_points) {
+        const size_t count = std::min(ply_chunk_points, vertices.size() - first);
+
+        char* out = buffer.data();
+        for (size_t i = first; i < first + count; i++) {
+            std::memcpy(out, &vertices[i].position, 3 * sizeof(float));
+            out[12] = static_cast<char>(to_color_byte(vertices[i].color.x));
+            out[13] = static_cast<char>(to_color_byte(vertices[i].color.y));
+            out[14] = static_cast<char>(to_color_byte(vertices[i].color.z));
+            out += ply_point_size;
+        }
+
+        ofs.write(buffer.data(), count * ply_point_size);
+    }
+
+    if (ofs.fail())
+        return std::unexpected("Failed to write " + path.string() + ".");
+
+    return {};
+}
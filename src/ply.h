@@ -0,0 +1,10 @@
+#pragma once
+
+#include <expected>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "depth_cloud.h"
+
+// Writes the points as a binary little endian PLY with float x, y, z and uchar red, green, blue.
+std::expected<void, std::string> write_ply(const std::filesystem::path& path, const std::vector<vertex_t>& vertices);
@@ -0,0 +1,402 @@
+#include "point_renderer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "frame_timing.h"
+#include "trace.h"
+
+struct mesh_t {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+};
+
+static std::expected<std::string, std::string> read_file_contents(const std::filesystem::path& path) {
+    std::ifstream ifs(path);
+
+    if (ifs.fail())
+        return std::unexpected("Failed to read contents of file " + path.string());
+
+    return std::string(
+        (std::istreambuf_iterator<char>(ifs)),
+        (std::istreambuf_iterator<char>())
+    );
+}
+
+static std::expected<GLuint, std::string> create_shader(GLenum type, const std::string& src) {
+    auto id = glCreateShader(type);
+
+    const char* src_cstr = src.c_str();
+    glShaderSource(id, 1, &src_cstr, nullptr);
+    glCompileShader(id);
+
+    GLint success;
+    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLsizei log_length;
+        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &log_length);
+
+        std::string log;
+        if (log_length > 0) {
+            log.resize(log_length);
+            glGetShaderInfoLog(id, log_length, nullptr, &log[0]);
+        }
+
+        // Cleanup resource if it fails to compile.
+        glDeleteShader(id);
+
+        return std::unexpected("Shader compilation error: " + log);
+    }
+
+    return id;
+}
+
+static std::expected<GLuint, std::string> create_program(GLuint vs, GLuint fs) {
+    auto program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        GLsizei log_length;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_length);
+
+        std::string log;
+        if (log_length > 0) {
+            log.resize(log_length);
+            glGetProgramInfoLog(program, log_length, nullptr, &log[0]);
+        }
+
+        // Cleanup resource if it fails to link.
+        glDeleteProgram(program);
+
+        return std::unexpected("Shader program linking error: " + log);
+    }
+
+    return program;
+}
+
+static std::expected<GLuint, std::string> create_program(
+    const std::filesystem::path& vs_path,
+    const std::filesystem::path& fs_path
+) {
+    const auto vs_src = read_file_contents(vs_path);
+    if (!vs_src) return std::unexpected(vs_src.error());
+
+    const auto fs_src = read_file_contents(fs_path);
+    if (!fs_src) return std::unexpected(fs_src.error());
+
+    const auto vs = create_shader(GL_VERTEX_SHADER, *vs_src);
+    if (!vs) return std::unexpected(vs.error());
+
+    const auto fs = create_shader(GL_FRAGMENT_SHADER, *fs_src);
+    // Be sure to delete vs, if fs fails.
+    if (!fs) {
+        glDeleteShader(*vs);
+        return std::unexpected(fs.error());
+    }
+
+    const auto program = create_program(*vs, *fs);
+    // Delete now we have made program. This will also delete if program fails too.
+    glDeleteShader(*vs);
+    glDeleteShader(*fs);
+    if (!program)
+        return std::unexpected(program.error());
+    return program;
+}
+
+// Points attributes 1 and 2 of the bound VAO at the point cloud VBO, which must be bound.
+// Instanced draws have no base instance in GL 4.1, so ranges are drawn by starting the
+// attributes at their first point instead.
+static void set_point_attributes(vertex_layout_t layout, size_t first_point = 0) {
+    if (layout == vertex_layout_t::packed) {
+        const auto base = first_point * sizeof(packed_vertex_t);
+        glVertexAttribPointer(1, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packed_vertex_t), reinterpret_cast<void*>(base));
+        glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(packed_vertex_t), reinterpret_cast<void*>(base + offsetof(packed_vertex_t, color)));
+    }
+    else {
+        const auto base = first_point * sizeof(vertex_t);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(base));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(base + sizeof(glm::vec3)));
+    }
+}
+
+// Drops the parts of the ranges past limit, which haven't been uploaded yet.
+static void clamp_draw_ranges(std::vector<draw_range_t>& ranges, size_t limit) {
+    std::erase_if(ranges, [&](const draw_range_t& range) { return range.first >= limit; });
+    for (auto& range : ranges)
+        range.count = static_cast<uint32_t>(std::min<size_t>(range.count, limit - range.first));
+}
+
+std::expected<std::unique_ptr<point_renderer_t>, std::string> point_renderer_t::create(
+    const std::filesystem::path& vs_path,
+    const std::filesystem::path& fs_path
+) {
+    const auto program = create_program(vs_path, fs_path);
+    if (!program)
+        return std::unexpected(program.error());
+
+    // Not make_unique, as the constructor is private.
+    auto renderer = std::unique_ptr<point_renderer_t>(new point_renderer_t());
+    renderer->program = *program;
+    glUseProgram(renderer->program);
+
+    renderer->projection_uniform = glGetUniformLocation(renderer->program, "projection_matrix");
+    renderer->view_uniform = glGetUniformLocation(renderer->program, "view_matrix");
+    renderer->model_uniform = glGetUniformLocation(renderer->program, "model_matrix");
+    renderer->reproject_uniform = glGetUniformLocation(renderer->program, "reproject");
+    renderer->stride_uniform = glGetUniformLocation(renderer->program, "stride");
+    renderer->focal_length_uniform = glGetUniformLocation(renderer->program, "focal_length");
+    renderer->principal_point_uniform = glGetUniformLocation(renderer->program, "principal_point");
+    renderer->sprite_uniform = glGetUniformLocation(renderer->program, "sprite");
+    renderer->voxel_scale_uniform = glGetUniformLocation(renderer->program, "voxel_scale");
+    renderer->viewport_height_uniform = glGetUniformLocation(renderer->program, "viewport_height");
+    renderer->splat_shape_uniform = glGetUniformLocation(renderer->program, "splat_shape");
+    renderer->position_offset_uniform = glGetUniformLocation(renderer->program, "position_offset");
+    renderer->position_extent_uniform = glGetUniformLocation(renderer->program, "position_extent");
+    renderer->metric_depth_uniform = glGetUniformLocation(renderer->program, "metric_depth");
+
+    // Texture units are fixed, only the textures bound to them change.
+    glUniform1i(glGetUniformLocation(renderer->program, "depth_texture"), 0);
+    glUniform1i(glGetUniformLocation(renderer->program, "color_texture"), 1);
+    glUniform1i(glGetUniformLocation(renderer->program, "metric_depth_texture"), 2);
+
+    const mesh_t cube_mesh{
+        .vertices = {
+            -1, -1, -1,
+            1, -1, -1,
+            1, 1, -1,
+            -1, 1, -1,
+            -1, -1, 1,
+            1, -1, 1,
+            1, 1, 1,
+            -1, 1, 1
+        },
+        .indices = {
+            0, 1, 3,
+            3, 1, 2,
+            1, 5, 2,
+            2, 5, 6,
+            5, 4, 6,
+            6, 4, 7,
+            4, 0, 7,
+            7, 0, 3,
+            3, 2, 7,
+            7, 2, 6,
+            4, 5, 0,
+            0, 5, 1
+        }
+    };
+    renderer->mesh_index_count = static_cast<GLsizei>(cube_mesh.indices.size());
+
+    glGenVertexArrays(1, &renderer->vao);
+    glBindVertexArray(renderer->vao);
+
+    glGenBuffers(1, &renderer->mesh_vbo);
+    glGenBuffers(1, &renderer->mesh_ebo);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->mesh_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cube_mesh.vertices.size() * sizeof(float), cube_mesh.vertices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->mesh_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cube_mesh.indices.size() * sizeof(unsigned int), cube_mesh.indices.data(), GL_STATIC_DRAW);
+
+    // TODO: Fix sizing
+    // Cube mesh vertex position.
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+    glEnableVertexAttribArray(0);
+
+    // The point attributes are pointed at a cloud by bind_point_cloud.
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    // Position
+    glVertexAttribDivisor(1, 1);
+    // Color
+    glVertexAttribDivisor(2, 1);
+
+    // Sprites read the same point cloud VBO, but one vertex per point instead of one instance.
+    glGenVertexArrays(1, &renderer->sprite_vao);
+    glBindVertexArray(renderer->sprite_vao);
+
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    glBindVertexArray(renderer->vao);
+
+    glGenTextures(1, &renderer->depth_texture);
+    glGenTextures(1, &renderer->metric_depth_texture);
+    glGenTextures(1, &renderer->color_texture);
+
+    // Only ever read with texelFetch, but integer textures are incomplete with linear filtering.
+    for (const auto texture : { renderer->depth_texture, renderer->metric_depth_texture, renderer->color_texture }) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return renderer;
+}
+
+point_renderer_t::~point_renderer_t() {
+    const GLuint textures[] = { depth_texture, metric_depth_texture, color_texture };
+    glDeleteTextures(3, textures);
+    const GLuint buffers[] = { mesh_vbo, mesh_ebo };
+    glDeleteBuffers(2, buffers);
+    const GLuint vaos[] = { vao, sprite_vao };
+    glDeleteVertexArrays(2, vaos);
+    glDeleteProgram(program);
+}
+
+void point_renderer_t::bind_point_cloud(GLuint vbo, vertex_layout_t layout) {
+    point_vbo = vbo;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (const auto point_vao : { vao, sprite_vao }) {
+        glBindVertexArray(point_vao);
+        set_point_attributes(layout);
+    }
+    glBindVertexArray(vao);
+}
+
+void point_renderer_t::upload_depth_textures(const depth_images_t& images) {
+    TRACE_SCOPE("upload textures");
+
+    // RGB8 rows are not 4-byte aligned for most widths.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (images.metric_depth.data) {
+        glBindTexture(GL_TEXTURE_2D, metric_depth_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, images.width, images.height, 0, GL_RED, GL_FLOAT, images.metric_depth.data);
+    }
+    else {
+        glBindTexture(GL_TEXTURE_2D, depth_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, images.width, images.height, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, images.depth.get());
+    }
+
+    glBindTexture(GL_TEXTURE_2D, color_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, images.width, images.height, 0, GL_RGB, GL_UNSIGNED_BYTE, images.rgb.get());
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    texture_metric_depth = images.metric_depth.data != nullptr;
+    depth_texture_size = glm::ivec2(images.width, images.height);
+}
+
+point_draw_stats_t point_renderer_t::draw(const point_cloud_t* cloud, const point_draw_settings_t& settings) {
+    TRACE_SCOPE("draw points");
+
+    point_draw_stats_t stats = {};
+    const bool draw_reprojected = cloud == nullptr;
+    if (draw_reprojected && !depth_texture_size)
+        return stats;
+
+    const bool sprite = settings.render_mode == render_mode_t::sprite;
+    const auto count = draw_reprojected
+        ? get_depth_cloud_size((*depth_texture_size).x, (*depth_texture_size).y, settings.stride)
+        : cloud->count;
+
+    auto model_mat = glm::mat4(1.f);
+    model_mat = glm::scale(model_mat, glm::vec3(settings.voxel_scale, settings.voxel_scale, settings.voxel_scale));
+
+    glUseProgram(program);
+    glUniformMatrix4fv(projection_uniform, 1, GL_FALSE, glm::value_ptr(settings.projection));
+    glUniformMatrix4fv(view_uniform, 1, GL_FALSE, glm::value_ptr(settings.view));
+    glUniformMatrix4fv(model_uniform, 1, GL_FALSE, glm::value_ptr(model_mat));
+
+    glUniform1i(reproject_uniform, draw_reprojected);
+    glUniform1i(sprite_uniform, sprite);
+    glUniform1f(voxel_scale_uniform, settings.voxel_scale);
+    glUniform1f(viewport_height_uniform, settings.viewport_height);
+    glUniform1i(splat_shape_uniform, static_cast<int>(settings.splat_shape));
+
+    if (!draw_reprojected) {
+        glUniform3fv(position_offset_uniform, 1, glm::value_ptr(cloud->position_offset));
+        glUniform3fv(position_extent_uniform, 1, glm::value_ptr(cloud->position_extent));
+    }
+
+    glBindVertexArray(sprite ? sprite_vao : vao);
+    glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
+
+    if (draw_reprojected) {
+        glUniform1i(stride_uniform, static_cast<GLint>(settings.stride));
+        const auto intrinsics = resolve_intrinsics(settings.intrinsics, depth_texture_size->x, depth_texture_size->y);
+        glUniform2f(focal_length_uniform, intrinsics.fx, intrinsics.fy);
+        glUniform2f(principal_point_uniform, intrinsics.cx, intrinsics.cy);
+        glUniform1i(metric_depth_uniform, texture_metric_depth);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depth_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, color_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, metric_depth_texture);
+        glActiveTexture(GL_TEXTURE0);
+
+        // Positions and colors come from the textures, so don't source the (possibly empty) VBO.
+        glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(2);
+    }
+
+    draw_ranges.clear();
+    if (!draw_reprojected && (settings.frustum_culling || settings.level_of_detail)) {
+        TRACE_SCOPE("cull octree");
+        cpu_timer_t cull_timer;
+        // The shader adds each offset with w = 1 on top of the model's w = 1, so points
+        // end up at offset / 2. Fold that in so the octree can be culled in offset space.
+        auto offset_to_world = glm::mat4(1.f);
+        offset_to_world[3][3] = 2.f;
+        const auto clip_mat = settings.projection * settings.view * offset_to_world;
+
+        if (settings.level_of_detail) {
+            const lod_settings_t lod_settings {
+                .pixels_per_unit = settings.projection[1][1] * settings.viewport_height * .5f,
+                .target_spacing = settings.lod_point_spacing,
+                .point_budget = settings.lod_point_budget
+            };
+            select_point_octree_lod(cloud->octree, clip_mat, settings.voxel_scale, lod_settings, draw_ranges);
+        }
+        else
+            cull_point_octree(cloud->octree, clip_mat, settings.voxel_scale, draw_ranges);
+        stats.cull_ms = cull_timer.elapsed_ms();
+    }
+    else
+        draw_ranges.push_back(draw_range_t { 0, static_cast<uint32_t>(count) });
+
+    if (!draw_reprojected && cloud->uploaded < count)
+        clamp_draw_ranges(draw_ranges, cloud->uploaded);
+
+    draw_firsts.clear();
+    draw_counts.clear();
+    for (const auto& range : draw_ranges) {
+        draw_firsts.push_back(range.first);
+        draw_counts.push_back(range.count);
+        stats.drawn_points += range.count;
+    }
+    stats.draw_calls = draw_counts.size();
+
+    if (sprite)
+        glMultiDrawArrays(GL_POINTS, draw_firsts.data(), draw_counts.data(), static_cast<GLsizei>(draw_ranges.size()));
+    else {
+        for (const auto& range : draw_ranges) {
+            if (!draw_reprojected)
+                set_point_attributes(cloud->layout, range.first);
+            glDrawElementsInstanced(GL_TRIANGLES, mesh_index_count, GL_UNSIGNED_INT, 0, range.count);
+        }
+        if (!draw_reprojected)
+            set_point_attributes(cloud->layout);
+    }
+
+    if (draw_reprojected) {
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+    }
+
+    glBindVertexArray(vao);
+    return stats;
+}
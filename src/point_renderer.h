@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+#include "octree.h"
+
+enum class render_mode_t {
+    // Every point is an instanced cube.
+    cube,
+    // Every point is a single screen-space sized GL_POINTS vertex.
+    sprite
+};
+
+enum class splat_shape_t {
+    square,
+    round
+};
+
+// What is currently uploaded to a point cloud VBO.
+struct point_cloud_t {
+    vertex_layout_t layout;
+    size_t count;
+    // Dequantizes packed positions. Identity for the full layout.
+    glm::vec3 position_offset;
+    glm::vec3 position_extent;
+    point_octree_t octree;
+    // Points that have been streamed into the VBO so far, always the first ones.
+    size_t uploaded;
+};
+
+struct point_draw_settings_t {
+    glm::mat4 projection;
+    glm::mat4 view;
+    float viewport_height;
+    render_mode_t render_mode;
+    splat_shape_t splat_shape;
+    float voxel_scale;
+    // Octree options, which only apply to generated clouds.
+    bool frustum_culling;
+    bool level_of_detail;
+    float lod_point_spacing;
+    size_t lod_point_budget;
+    // GPU reprojection options. Lens distortion is ignored, only the CPU undistorts.
+    unsigned int stride;
+    camera_intrinsics_t intrinsics;
+};
+
+struct point_draw_stats_t {
+    size_t drawn_points;
+    size_t draw_calls;
+    // Set when the octree was culled or had its level of detail selected.
+    std::optional<float> cull_ms;
+};
+
+// The point pass: the shader program, the cube mesh each point is instanced from, the VAOs
+// that source a point cloud VBO, and the textures GPU reprojection reads from. Shared by the
+// viewer and the headless render benchmark, so both draw exactly the same way.
+class point_renderer_t {
+public:
+    // Needs a current GL context.
+    static std::expected<std::unique_ptr<point_renderer_t>, std::string> create(
+        const std::filesystem::path& vs_path,
+        const std::filesystem::path& fs_path
+    );
+    ~point_renderer_t();
+
+    point_renderer_t(const point_renderer_t&) = delete;
+    point_renderer_t& operator=(const point_renderer_t&) = delete;
+
+    // Points both VAOs at a cloud in vbo, which is left bound.
+    void bind_point_cloud(GLuint vbo, vertex_layout_t layout);
+
+    // Uploads the depth map and image for reprojection in the vertex shader. Float depth maps
+    // go to their own texture.
+    void upload_depth_textures(const depth_images_t& images);
+    // Size of the images in the depth textures, once some have been uploaded.
+    std::optional<glm::ivec2> texture_size() const { return depth_texture_size; }
+
+    // Draws the uploaded part of the cloud bound with bind_point_cloud, or reprojects the
+    // depth textures when cloud is null.
+    point_draw_stats_t draw(const point_cloud_t* cloud, const point_draw_settings_t& settings);
+
+private:
+    point_renderer_t() = default;
+
+    GLuint program = 0;
+    GLint projection_uniform = -1;
+    GLint view_uniform = -1;
+    GLint model_uniform = -1;
+    GLint reproject_uniform = -1;
+    GLint stride_uniform = -1;
+    GLint focal_length_uniform = -1;
+    GLint principal_point_uniform = -1;
+    GLint sprite_uniform = -1;
+    GLint voxel_scale_uniform = -1;
+    GLint viewport_height_uniform = -1;
+    GLint splat_shape_uniform = -1;
+    GLint position_offset_uniform = -1;
+    GLint position_extent_uniform = -1;
+    GLint metric_depth_uniform = -1;
+
+    GLuint vao = 0;
+    GLuint sprite_vao = 0;
+    // The cloud VBO both VAOs currently source.
+    GLuint point_vbo = 0;
+    GLuint mesh_vbo = 0;
+    GLuint mesh_ebo = 0;
+    GLsizei mesh_index_count = 0;
+
+    GLuint depth_texture = 0;
+    GLuint metric_depth_texture = 0;
+    GLuint color_texture = 0;
+    std::optional<glm::ivec2> depth_texture_size;
+    // Whether the textures hold a float depth map.
+    bool texture_metric_depth = false;
+
+    // Reused every frame to avoid reallocating.
+    std::vector<draw_range_t> draw_ranges;
+    std::vector<GLint> draw_firsts;
+    std::vector<GLsizei> draw_counts;
+};
@@ -0,0 +1,166 @@
+#include "point_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <SDL.h>
+#include "octree.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Not part of the 4.1 core profile glad was generated for.
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+using buffer_storage_proc_t = void (APIENTRY*)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+point_stream_t::point_stream_t() {
+    if (!SDL_GL_ExtensionSupported("GL_ARB_buffer_storage"))
+        return;
+
+    const auto buffer_storage = reinterpret_cast<buffer_storage_proc_t>(SDL_GL_GetProcAddress("glBufferStorage"));
+    if (!buffer_storage)
+        return;
+
+    constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &staging_buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, staging_buffer);
+    buffer_storage(GL_COPY_READ_BUFFER, slot_count * slot_bytes, nullptr, flags);
+    staging = static_cast<std::byte*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, slot_count * slot_bytes, flags));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    // Fall back to mapped ranges rather than fail.
+    if (!staging) {
+        glDeleteBuffers(1, &staging_buffer);
+        staging_buffer = 0;
+    }
+}
+
+point_stream_t::~point_stream_t() {
+    for (const auto fence : fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+
+    // Deleting a buffer unmaps it.
+    if (staging_buffer)
+        glDeleteBuffers(1, &staging_buffer);
+}
+
+size_t point_stream_t::begin(GLuint vbo, generation_output_t&& output) {
+    const bool packed = output.layout == vertex_layout_t::packed;
+    vertex_size = packed ? sizeof(packed_vertex_t) : sizeof(vertex_t);
+    total = !output.cached_vertices.empty()
+        ? output.cached_vertices.size() / vertex_size
+        : packed ? output.packed_vertices->size() : output.vertices->size();
+    uploaded = 0;
+    target = vbo;
+
+    // Only storage for the points, which are then filled in by update.
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+    glBufferData(GL_COPY_WRITE_BUFFER, total * vertex_size, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    source = std::move(output);
+    if (total == 0)
+        source.reset();
+
+    return total;
+}
+
+size_t point_stream_t::update(thread_pool_t& pool) {
+    if (!source)
+        return uploaded;
+
+    TRACE_SCOPE("upload points");
+    if (persistent())
+        upload_persistent(pool);
+    else
+        upload_mapped(pool);
+
+    if (uploaded == total)
+        source.reset();
+
+    return uploaded;
+}
+
+void point_stream_t::cancel() {
+    source.reset();
+}
+
+void point_stream_t::fill(std::byte* destination, size_t first, size_t count, thread_pool_t& pool) const {
+    // The reorder into octree order, straight into GL memory.
+    TRACE_SCOPE("gather points");
+    if (!source->cached_vertices.empty())
+        std::memcpy(destination, source->cached_vertices.data() + first * vertex_size, count * vertex_size);
+    else if (source->layout == vertex_layout_t::packed)
+        gather_points(*source->packed_vertices, *source->order, first, count, reinterpret_cast<packed_vertex_t*>(destination), pool);
+    else
+        gather_points(*source->vertices, *source->order, first, count, reinterpret_cast<vertex_t*>(destination), pool);
+}
+
+void point_stream_t::upload_persistent(thread_pool_t& pool) {
+    const size_t slot_points = slot_bytes / vertex_size;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, staging_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+
+    for (size_t i = 0; i < slot_count && uploaded < total; i++) {
+        auto& fence = fences[next_slot];
+        if (fence) {
+            // Still being copied out of, so try again next frame rather than wait.
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                break;
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        const size_t count = std::min(slot_points, total - uploaded);
+        const size_t offset = next_slot * slot_bytes;
+
+        // Coherent, so the writes are visible to the copy without a flush.
+        fill(staging + offset, uploaded, count, pool);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, uploaded * vertex_size, count * vertex_size);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        uploaded += count;
+        next_slot = (next_slot + 1) % slot_count;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void point_stream_t::upload_mapped(thread_pool_t& pool) {
+    const size_t slot_points = slot_bytes / vertex_size;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+
+    for (size_t i = 0; i < slot_count && uploaded < total; i++) {
+        const size_t count = std::min(slot_points, total - uploaded);
+        const size_t bytes = count * vertex_size;
+
+        // Nothing draws past the uploaded points, so the range is never in use by the GPU.
+        auto mapped = static_cast<std::byte*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, uploaded * vertex_size, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        if (mapped)
+            fill(mapped, uploaded, count, pool);
+
+        // The contents of a mapping can be lost, for example on a display mode change, in which
+        // case unmapping fails and the chunk goes through a temporary copy instead.
+        if (!mapped || glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE) {
+            std::vector<std::byte> chunk(bytes);
+            fill(chunk.data(), uploaded, count, pool);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, uploaded * vertex_size, bytes, chunk.data());
+        }
+
+        uploaded += count;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <glad/glad.h>
+#include "generation_job.h"
+
+class thread_pool_t;
+
+// Streams a generated cloud into a VBO a few chunks per frame, so large uploads don't stall
+// the frame they land in. With GL_ARB_buffer_storage, chunks go through a persistently mapped
+// staging ring guarded by fences and are copied on the GPU. Without it, each chunk is written
+// through a mapped range of the VBO instead.
+class point_stream_t {
+public:
+    // Needs a current GL context.
+    point_stream_t();
+    ~point_stream_t();
+
+    point_stream_t(const point_stream_t&) = delete;
+    point_stream_t& operator=(const point_stream_t&) = delete;
+
+    bool persistent() const { return staging_buffer != 0; }
+    bool active() const { return source.has_value(); }
+
+    // Reallocates vbo to fit the points and starts streaming them in octree order, dropping
+    // any stream still in progress. Returns the number of points.
+    size_t begin(GLuint vbo, generation_output_t&& output);
+
+    // Uploads the next chunks, skipping staging slots the GPU hasn't finished copying out of.
+    // Returns the number of points uploaded so far, which are always the first ones. The
+    // source is released once everything is uploaded.
+    size_t update(thread_pool_t& pool);
+
+    // Stops streaming, leaving the rest of the VBO undefined.
+    void cancel();
+
+private:
+    // Writes count points starting at first, in octree order.
+    void fill(std::byte* destination, size_t first, size_t count, thread_pool_t& pool) const;
+    void upload_persistent(thread_pool_t& pool);
+    void upload_mapped(thread_pool_t& pool);
+
+    static constexpr size_t slot_count = 3;
+    static constexpr size_t slot_bytes = 16 * 1024 * 1024;
+
+    GLuint staging_buffer = 0;
+    std::byte* staging = nullptr;
+    std::array<GLsync, slot_count> fences = {};
+    size_t next_slot = 0;
+
+    std::optional<generation_output_t> source;
+    GLuint target = 0;
+    size_t vertex_size = 0;
+    size_t total = 0;
+    size_t uploaded = 0;
+};
@@ -0,0 +1,154 @@
+#include "ray_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <mutex>
+#include "thread_pool.h"
+#include "trace.h"
+
+// Tables for a 4K map at stride 1 are 66 MB, so only keep a few.
+static constexpr size_t ray_table_cache_size = 4;
+// Fixed point iterations converge to well under a float's precision within this many steps
+// for any real lens, and stop early once they have.
+static constexpr int undistort_iterations = 20;
+
+camera_intrinsics_t make_pinhole_intrinsics(float focal_length) {
+    return camera_intrinsics_t {
+        .fx = focal_length,
+        .fy = focal_length,
+        .cx = -1.f,
+        .cy = -1.f,
+        .k1 = 0.f,
+        .k2 = 0.f,
+        .k3 = 0.f,
+        .p1 = 0.f,
+        .p2 = 0.f
+    };
+}
+
+camera_intrinsics_t resolve_intrinsics(const camera_intrinsics_t& intrinsics, int width, int height) {
+    auto resolved = intrinsics;
+    if (resolved.cx < 0.f)
+        resolved.cx = static_cast<float>(width) * .5f;
+    if (resolved.cy < 0.f)
+        resolved.cy = static_cast<float>(height) * .5f;
+    return resolved;
+}
+
+bool has_distortion(const camera_intrinsics_t& intrinsics) {
+    return intrinsics.k1 != 0.f || intrinsics.k2 != 0.f || intrinsics.k3 != 0.f || intrinsics.p1 != 0.f || intrinsics.p2 != 0.f;
+}
+
+// Inverts the Brown-Conrady model for a distorted normalized coordinate, the same fixed point
+// iteration OpenCV's undistortPoints uses.
+static void undistort(const camera_intrinsics_t& intrinsics, double xd, double yd, double& x, double& y) {
+    x = xd;
+    y = yd;
+
+    for (int iteration = 0; iteration < undistort_iterations; iteration++) {
+        const double r2 = x * x + y * y;
+        const double radial = 1.0 + r2 * (intrinsics.k1 + r2 * (intrinsics.k2 + r2 * intrinsics.k3));
+        const double dx = 2.0 * intrinsics.p1 * x * y + intrinsics.p2 * (r2 + 2.0 * x * x);
+        const double dy = intrinsics.p1 * (r2 + 2.0 * y * y) + 2.0 * intrinsics.p2 * x * y;
+
+        const double next_x = (xd - dx) / radial;
+        const double next_y = (yd - dy) / radial;
+        const bool converged = std::abs(next_x - x) < 1e-9 && std::abs(next_y - y) < 1e-9;
+        x = next_x;
+        y = next_y;
+        if (converged)
+            break;
+    }
+}
+
+static std::shared_ptr<const ray_table_t> build_ray_table(
+    int width,
+    int height,
+    unsigned int stride,
+    const camera_intrinsics_t& intrinsics,
+    thread_pool_t& pool
+) {
+    TRACE_SCOPE("build ray table");
+
+    auto table = std::make_shared<ray_table_t>();
+    table->width = width;
+    table->height = height;
+    table->stride = stride;
+    table->intrinsics = resolve_intrinsics(intrinsics, width, height);
+    table->columns = (width + stride - 1) / stride;
+    table->rows = (height + stride - 1) / stride;
+    table->separable = !has_distortion(intrinsics);
+
+    const auto& resolved = table->intrinsics;
+    const float inv_fx = 1.f / resolved.fx;
+    const float inv_fy = 1.f / resolved.fy;
+
+    // Image x runs right and y down, while the cloud's run left and up, hence cx - u rather
+    // than u - cx.
+    if (table->separable) {
+        table->x_factors.resize(table->columns);
+        table->y_factors.resize(table->rows);
+        for (size_t column = 0; column < table->columns; column++)
+            table->x_factors[column] = (resolved.cx - static_cast<float>(column * stride)) * inv_fx;
+        for (size_t row = 0; row < table->rows; row++)
+            table->y_factors[row] = (resolved.cy - static_cast<float>(row * stride)) * inv_fy;
+    }
+    else {
+        table->x_factors.resize(table->columns * table->rows);
+        table->y_factors.resize(table->columns * table->rows);
+        pool.parallel_for(table->rows, [&](size_t row) {
+            const double yd = (static_cast<double>(row * stride) - resolved.cy) / resolved.fy;
+            for (size_t column = 0; column < table->columns; column++) {
+                const double xd = (static_cast<double>(column * stride) - resolved.cx) / resolved.fx;
+                double x, y;
+                undistort(resolved, xd, yd, x, y);
+                table->x_factors[row * table->columns + column] = static_cast<float>(-x);
+                table->y_factors[row * table->columns + column] = static_cast<float>(-y);
+            }
+        });
+    }
+
+    const auto [x_min, x_max] = std::minmax_element(table->x_factors.begin(), table->x_factors.end());
+    const auto [y_min, y_max] = std::minmax_element(table->y_factors.begin(), table->y_factors.end());
+    table->x_min = *x_min;
+    table->x_max = *x_max;
+    table->y_min = *y_min;
+    table->y_max = *y_max;
+    return table;
+}
+
+std::shared_ptr<const ray_table_t> get_ray_table(
+    int width,
+    int height,
+    unsigned int stride,
+    const camera_intrinsics_t& intrinsics,
+    thread_pool_t& pool
+) {
+    static std::mutex mutex;
+    // Most recently used first.
+    static std::list<std::shared_ptr<const ray_table_t>> tables;
+
+    const auto resolved = resolve_intrinsics(intrinsics, width, height);
+    const auto matches = [&](const std::shared_ptr<const ray_table_t>& table) {
+        return table->width == width && table->height == height && table->stride == stride && table->intrinsics == resolved;
+    };
+
+    {
+        std::lock_guard lock(mutex);
+        if (const auto it = std::ranges::find_if(tables, matches); it != tables.end()) {
+            tables.splice(tables.begin(), tables, it);
+            return tables.front();
+        }
+    }
+
+    // Built outside the lock, as it runs on the pool. Two threads asking for the same new
+    // table at once both build it, which is only wasted work.
+    auto table = build_ray_table(width, height, stride, resolved, pool);
+
+    std::lock_guard lock(mutex);
+    tables.push_front(table);
+    if (tables.size() > ray_table_cache_size)
+        tables.pop_back();
+    return table;
+}
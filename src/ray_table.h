@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class thread_pool_t;
+
+// Pinhole intrinsics in pixels plus Brown-Conrady lens distortion, as OpenCV calibrates them.
+struct camera_intrinsics_t {
+    float fx;
+    float fy;
+    // Principal point. Negative uses the image center, for when the image size isn't known up front.
+    float cx;
+    float cy;
+    // Radial coefficients.
+    float k1;
+    float k2;
+    float k3;
+    // Tangential coefficients.
+    float p1;
+    float p2;
+
+    bool operator==(const camera_intrinsics_t&) const = default;
+};
+
+// The model clouds were generated with before intrinsics: one focal length, the principal
+// point at the image center and no distortion.
+camera_intrinsics_t make_pinhole_intrinsics(float focal_length);
+// Fills in a principal point left at the image center.
+camera_intrinsics_t resolve_intrinsics(const camera_intrinsics_t& intrinsics, int width, int height);
+bool has_distortion(const camera_intrinsics_t& intrinsics);
+
+// Back-projection factors for every sampled pixel, so a pixel at depth d ends up at
+// d * (x, y, 1) without undistorting anything per frame. Without distortion the factors are
+// separable, and x is stored per column and y per row. With it both are stored per sample,
+// row by row.
+struct ray_table_t {
+    int width;
+    int height;
+    unsigned int stride;
+    // Resolved, so the principal point is never negative.
+    camera_intrinsics_t intrinsics;
+    size_t columns;
+    size_t rows;
+    bool separable;
+    std::vector<float> x_factors;
+    std::vector<float> y_factors;
+    // Ranges of the factors, which bound the cloud for a given max depth.
+    float x_min;
+    float x_max;
+    float y_min;
+    float y_max;
+};
+
+// Returns the table for a width * height map sampled at stride, building it on the pool the
+// first time. The last few tables are kept, so regenerating or playing a sequence at one
+// resolution reuses them. Safe to call from any thread.
+std::shared_ptr<const ray_table_t> get_ray_table(
+    int width,
+    int height,
+    unsigned int stride,
+    const camera_intrinsics_t& intrinsics,
+    thread_pool_t& pool
+);
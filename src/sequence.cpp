@@ -0,0 +1,222 @@
+#include "sequence.h"
+
+#include <algorithm>
+#include <cmath>
+#include "point_stream.h"
+#include "thread_pool.h"
+
+sequence_player_t::sequence_player_t(sequence_settings_t settings, point_stream_t& stream, std::function<void()> on_frame_ready)
+    : sequence(std::move(settings)), stream(stream), on_frame_ready(std::move(on_frame_ready)) {
+    // One slot is always held by the frame on screen, so a single slot could never advance.
+    sequence.ring_size = std::max<size_t>(sequence.ring_size, 2);
+    sequence.frame_count = std::max(sequence.frame_count, 1);
+
+    slots.resize(sequence.ring_size);
+    for (auto& slot : slots)
+        glGenBuffers(1, &slot.frame.vbo);
+}
+
+sequence_player_t::~sequence_player_t() {
+    // The stream would otherwise keep writing into a deleted buffer.
+    if (uploading)
+        stream.cancel();
+
+    for (auto& slot : slots) {
+        if (slot.job)
+            slot.job->cancel();
+        glDeleteBuffers(1, &slot.frame.vbo);
+    }
+}
+
+void sequence_player_t::get_wanted_indices(std::vector<int>& indices) const {
+    indices.clear();
+
+    const int due = position();
+    const int ahead = static_cast<int>(std::min<size_t>(sequence.ring_size, sequence.frame_count));
+    for (int i = 0; i < ahead; i++) {
+        int index = due + i;
+        if (index >= sequence.frame_count) {
+            if (!sequence.loop)
+                break;
+            index -= sequence.frame_count;
+        }
+        indices.push_back(index);
+    }
+}
+
+sequence_player_t::slot_t* sequence_player_t::find_slot(int index) {
+    for (auto& slot : slots) {
+        if (slot.state != slot_state_t::free && slot.index == index)
+            return &slot;
+    }
+    return nullptr;
+}
+
+void sequence_player_t::release(slot_t& slot) {
+    if (uploading == &slot) {
+        stream.cancel();
+        uploading = nullptr;
+    }
+
+    // A cancelled job finishes on its own, it just won't be waited for.
+    if (slot.job)
+        slot.job->cancel();
+    slot.job.reset();
+
+    slot.state = slot_state_t::free;
+    slot.index = -1;
+    slot.failed = false;
+    slot.frame.octree = {};
+}
+
+void sequence_player_t::start_upload(slot_t& slot) {
+    auto result = slot.job->take_result();
+    slot.job.reset();
+
+    if (!result) {
+        error_message = result.error();
+        slot.failed = true;
+        slot.state = slot_state_t::ready;
+        return;
+    }
+
+    slot.frame.frame = sequence.first_frame + slot.index;
+    slot.frame.layout = (*result).layout;
+    slot.frame.position_offset = (*result).position_offset;
+    slot.frame.position_extent = (*result).position_extent;
+    slot.frame.octree = std::move((*result).octree);
+    slot.frame.max_depth = (*result).max_depth;
+    slot.frame.count = stream.begin(slot.frame.vbo, std::move(*result));
+
+    if (stream.active()) {
+        slot.state = slot_state_t::uploading;
+        uploading = &slot;
+    }
+    else
+        slot.state = slot_state_t::ready;
+}
+
+bool sequence_player_t::update(float elapsed, thread_pool_t& pool) {
+    // The clock only starts once the first frame is up, rather than dropping frames while the
+    // ring fills.
+    if (is_playing && shown) {
+        clock += static_cast<double>(elapsed) * sequence.target_fps;
+        if (!sequence.loop && clock >= sequence.frame_count - 1) {
+            clock = sequence.frame_count - 1;
+            is_playing = false;
+        }
+    }
+
+    // Every frame the clock stepped past without it being displayed was dropped, including
+    // whole laps of a looping sequence.
+    const auto tick = static_cast<int64_t>(clock);
+    if (!seeked && tick != last_tick)
+        frame_stats.dropped += static_cast<size_t>(tick - last_tick - 1) + (shown_index != position_at(last_tick) ? 1 : 0);
+    seeked = false;
+    last_tick = tick;
+    const int due = position();
+
+    // Recycle slots holding frames that are behind the clock or too far ahead of it. The frame
+    // on screen stays until the next one is ready.
+    get_wanted_indices(wanted);
+    for (auto& slot : slots) {
+        if (slot.state != slot_state_t::free && &slot != shown && std::ranges::find(wanted, slot.index) == wanted.end())
+            release(slot);
+    }
+
+    for (const int index : wanted) {
+        if (find_slot(index))
+            continue;
+
+        const auto free_slot = std::ranges::find_if(slots, [](const slot_t& slot) { return slot.state == slot_state_t::free; });
+        if (free_slot == slots.end())
+            break;
+
+        const auto image_path = format_frame_path(sequence.image_pattern, sequence.first_frame + index);
+        const auto depth_path = format_frame_path(sequence.depth_pattern, sequence.first_frame + index);
+        if (!image_path || !depth_path) {
+            error_message = !image_path ? image_path.error() : depth_path.error();
+            break;
+        }
+
+        const generation_request_t request {
+            .image_path = *image_path,
+            .depth_path = *depth_path,
+            .intrinsics = sequence.intrinsics,
+            .stride = sequence.stride,
+            .flying_pixel_threshold = sequence.flying_pixel_threshold,
+            .voxel_size = sequence.voxel_size,
+            .images_only = false,
+            .layout = sequence.layout,
+            // Each frame is only generated and decoded once, so caching either would just fill
+            // the disk and evict others.
+            .cache_dir = {},
+            .cache_byte_budget = 0,
+            .image_cache = nullptr,
+            .images = nullptr
+        };
+        (*free_slot).state = slot_state_t::generating;
+        (*free_slot).index = index;
+        (*free_slot).job = std::make_unique<generation_job_t>(request, pool, on_frame_ready);
+    }
+
+    // The point stream takes one cloud at a time, so upload the nearest finished frame first.
+    if (!uploading) {
+        for (const int index : wanted) {
+            const auto slot = find_slot(index);
+            if (slot && (*slot).state == slot_state_t::generating && (*slot).job->finished()) {
+                start_upload(*slot);
+                break;
+            }
+        }
+    }
+
+    if (uploading) {
+        stream.update(pool);
+        if (!stream.active()) {
+            (*uploading).state = slot_state_t::ready;
+            uploading = nullptr;
+        }
+    }
+
+    const auto due_slot = find_slot(due);
+    if (!due_slot || due_slot == shown || (*due_slot).state != slot_state_t::ready || (*due_slot).failed)
+        return false;
+
+    shown = due_slot;
+    shown_index = due;
+    frame_stats.shown++;
+    return true;
+}
+
+const sequence_frame_t* sequence_player_t::displayed() const {
+    return shown ? &(*shown).frame : nullptr;
+}
+
+void sequence_player_t::set_playing(bool playing) {
+    // Restart from the beginning once a non-looping sequence has played through.
+    if (playing && !is_playing && !sequence.loop && position() == sequence.frame_count - 1)
+        seek(0);
+    is_playing = playing;
+}
+
+void sequence_player_t::seek(int index) {
+    clock = std::clamp(index, 0, sequence.frame_count - 1);
+    seeked = true;
+}
+
+int sequence_player_t::position_at(int64_t tick) const {
+    if (sequence.loop)
+        return static_cast<int>(tick % sequence.frame_count);
+    return static_cast<int>(std::min<int64_t>(tick, sequence.frame_count - 1));
+}
+
+int sequence_player_t::position() const {
+    return position_at(static_cast<int64_t>(clock));
+}
+
+size_t sequence_player_t::buffered() const {
+    return std::ranges::count_if(slots, [&](const slot_t& slot) {
+        return slot.state != slot_state_t::free && &slot != shown;
+    });
+}
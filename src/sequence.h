@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+#include "frame_pattern.h"
+#include "generation_job.h"
+#include "octree.h"
+
+class point_stream_t;
+class thread_pool_t;
+
+struct sequence_settings_t {
+    std::string image_pattern;
+    std::string depth_pattern;
+    int first_frame;
+    int frame_count;
+    float target_fps;
+    bool loop;
+    // Frames converted ahead of playback and held on the GPU, including the one on screen.
+    size_t ring_size;
+    camera_intrinsics_t intrinsics;
+    unsigned int stride;
+    float flying_pixel_threshold;
+    float voxel_size;
+    vertex_layout_t layout;
+};
+
+// A frame resident in one of the ring's VBOs.
+struct sequence_frame_t {
+    int frame;
+    GLuint vbo;
+    vertex_layout_t layout;
+    size_t count;
+    glm::vec3 position_offset;
+    glm::vec3 position_extent;
+    point_octree_t octree;
+    float max_depth;
+};
+
+struct sequence_stats_t {
+    size_t shown;
+    // Frames whose time came and went before they were ready.
+    size_t dropped;
+};
+
+// Plays a numbered image/depth sequence as an animated cloud. Upcoming frames are generated on
+// the thread pool and streamed into a bounded ring of VBOs, and shown once the playback clock
+// reaches them. Frames that aren't ready in time are skipped rather than waited for, so
+// playback keeps to the target rate.
+class sequence_player_t {
+public:
+    // Needs a current GL context. Frames are uploaded through stream, which must outlive the
+    // player. on_frame_ready is called from workers as frames finish generating.
+    sequence_player_t(sequence_settings_t settings, point_stream_t& stream, std::function<void()> on_frame_ready);
+    ~sequence_player_t();
+
+    sequence_player_t(const sequence_player_t&) = delete;
+    sequence_player_t& operator=(const sequence_player_t&) = delete;
+
+    // Advances the clock by elapsed seconds, schedules and uploads upcoming frames, and
+    // switches to the frame now due if it is ready. Returns true when the displayed frame
+    // changed. Frames that fail to generate are skipped, with the error kept in last_error.
+    bool update(float elapsed, thread_pool_t& pool);
+
+    const sequence_frame_t* displayed() const;
+    const sequence_settings_t& settings() const { return sequence; }
+    const sequence_stats_t& stats() const { return frame_stats; }
+    const std::string& last_error() const { return error_message; }
+
+    bool playing() const { return is_playing; }
+    void set_playing(bool playing);
+    // Jumps to a frame, relative to first_frame. Frames skipped by a seek aren't dropped.
+    void seek(int index);
+    // The frame due, relative to first_frame.
+    int position() const;
+    // Frames generated or being generated ahead of the displayed one.
+    size_t buffered() const;
+
+private:
+    enum class slot_state_t {
+        free,
+        generating,
+        uploading,
+        ready
+    };
+
+    struct slot_t {
+        slot_state_t state = slot_state_t::free;
+        // Relative to first_frame.
+        int index = -1;
+        std::unique_ptr<generation_job_t> job;
+        bool failed = false;
+        sequence_frame_t frame = {};
+    };
+
+    // The frame shown at a tick of the clock.
+    int position_at(int64_t tick) const;
+    // The frames that should be in the ring, nearest first.
+    void get_wanted_indices(std::vector<int>& indices) const;
+    slot_t* find_slot(int index);
+    void release(slot_t& slot);
+    void start_upload(slot_t& slot);
+
+    sequence_settings_t sequence;
+    point_stream_t& stream;
+    std::function<void()> on_frame_ready;
+    std::vector<slot_t> slots;
+    // Slot currently streaming through the point stream, if any.
+    slot_t* uploading = nullptr;
+    slot_t* shown = nullptr;
+    // Last frame displayed, which outlives its slot being recycled.
+    int shown_index = -1;
+
+    // In frames since first_frame, counting every lap of a looping sequence.
+    double clock = 0.0;
+    bool is_playing = true;
+    // Set by seek so the jump isn't counted as dropped frames.
+    bool seeked = true;
+    int64_t last_tick = 0;
+
+    sequence_stats_t frame_stats = {};
+    std::string error_message;
+    // Reused every update to avoid reallocating.
+    std::vector<int> wanted;
+};
@@ -0,0 +1,104 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "trace.h"
+
+thread_pool_t::thread_pool_t(unsigned int thread_count) {
+    if (thread_count == 0)
+        thread_count = default_thread_count();
+
+    workers.reserve(thread_count);
+    for (unsigned int i = 0; i < thread_count; i++)
+        workers.emplace_back([this]() { worker_loop(); });
+}
+
+thread_pool_t::~thread_pool_t() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+unsigned int thread_pool_t::default_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void thread_pool_t::submit(std::function<void()> task) {
+    {
+        std::lock_guard lock(mutex);
+        tasks.push(std::move(task));
+    }
+    cv.notify_one();
+}
+
+void thread_pool_t::parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+    if (count == 0)
+        return;
+
+    // Shared so that helpers which only get scheduled after the work is done can still
+    // safely find there is nothing left; fn itself is only touched while indices remain.
+    struct state_t {
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> done = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr error;
+    };
+    const auto state = std::make_shared<state_t>();
+
+    const auto run = [state, count, fn_ptr = &fn]() {
+        size_t i;
+        while ((i = state->next.fetch_add(1)) < count) {
+            try {
+                (*fn_ptr)(i);
+            }
+            catch (...) {
+                std::lock_guard lock(state->mutex);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+
+            if (state->done.fetch_add(1) + 1 == count) {
+                std::lock_guard lock(state->mutex);
+                state->cv.notify_all();
+            }
+        }
+    };
+
+    const auto helpers = std::min<size_t>(count, workers.size()) - 1;
+    for (size_t i = 0; i < helpers; i++)
+        submit(run);
+
+    run();
+
+    std::unique_lock lock(state->mutex);
+    state->cv.wait(lock, [&]() { return state->done.load() == count; });
+
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+void thread_pool_t::worker_loop() {
+    set_trace_thread_name("worker");
+
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
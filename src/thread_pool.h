@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads for the CPU-heavy parts of cloud generation.
+class thread_pool_t {
+public:
+    // A thread count of 0 uses std::thread::hardware_concurrency().
+    explicit thread_pool_t(unsigned int thread_count = 0);
+    ~thread_pool_t();
+
+    thread_pool_t(const thread_pool_t&) = delete;
+    thread_pool_t& operator=(const thread_pool_t&) = delete;
+
+    unsigned int thread_count() const { return static_cast<unsigned int>(workers.size()); }
+
+    // Queue a task to be run by one of the workers.
+    void submit(std::function<void()> task);
+
+    // Run fn(i) for every i in [0, count) and block until all calls have returned.
+    // The calling thread takes part, so at most thread_count() calls run at once and
+    // it is safe to call from inside a pool task. The first exception thrown is rethrown.
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn);
+
+    static unsigned int default_thread_count();
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
@@ -0,0 +1,141 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct trace_event_t {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// Each thread appends to its own buffer, so its lock is only ever contended by stop_trace.
+struct trace_thread_t {
+    uint32_t id;
+    std::string name;
+    std::mutex mutex;
+    std::vector<trace_event_t> events;
+};
+
+struct trace_registry_t {
+    std::mutex mutex;
+    // Shared with the threads' own references, so buffers of threads that exited still get written.
+    std::vector<std::shared_ptr<trace_thread_t>> threads;
+    uint64_t start_ns = 0;
+};
+
+static trace_registry_t& get_trace_registry() {
+    static trace_registry_t registry;
+    return registry;
+}
+
+static trace_thread_t& get_trace_thread() {
+    thread_local const auto thread = []() {
+        auto& registry = get_trace_registry();
+        std::lock_guard lock(registry.mutex);
+
+        auto thread = std::make_shared<trace_thread_t>();
+        thread->id = static_cast<uint32_t>(registry.threads.size() + 1);
+        registry.threads.push_back(thread);
+        return thread;
+    }();
+    return *thread;
+}
+
+void record_trace_span(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    auto& thread = get_trace_thread();
+    std::lock_guard lock(thread.mutex);
+    thread.events.push_back({ name, start_ns, end_ns });
+}
+
+void set_trace_thread_name(const char* name) {
+    auto& thread = get_trace_thread();
+    std::lock_guard lock(thread.mutex);
+    thread.name = name;
+}
+
+void start_trace() {
+    auto& registry = get_trace_registry();
+    {
+        std::lock_guard lock(registry.mutex);
+        for (const auto& thread : registry.threads) {
+            std::lock_guard thread_lock(thread->mutex);
+            thread->events.clear();
+        }
+        registry.start_ns = get_trace_time_ns();
+    }
+    trace_recording = true;
+}
+
+// Names are string literals from the source, but quotes or backslashes would still break the JSON.
+static void write_json_string(std::ofstream& ofs, const std::string& str) {
+    ofs << '"';
+    for (const char c : str) {
+        if (c == '"' || c == '\\')
+            ofs << '\\';
+        ofs << c;
+    }
+    ofs << '"';
+}
+
+std::expected<size_t, std::string> stop_trace(const std::filesystem::path& path) {
+    trace_recording = false;
+
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs)
+        return std::unexpected("Failed to write trace to " + path.string() + ".");
+
+    auto& registry = get_trace_registry();
+    std::lock_guard lock(registry.mutex);
+
+    size_t span_count = 0;
+    bool first = true;
+    char timestamp[64];
+
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const auto& thread : registry.threads) {
+        std::lock_guard thread_lock(thread->mutex);
+
+        if (!thread->name.empty()) {
+            ofs << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":";
+            write_json_string(ofs, thread->name);
+            ofs << "}}";
+            first = false;
+        }
+
+        for (const auto& event : thread->events) {
+            // Chrome traces are in microseconds, fractions keep the nanoseconds.
+            const auto start_ns = std::max(event.start_ns, registry.start_ns) - registry.start_ns;
+            std::snprintf(timestamp, sizeof(timestamp), "\"ts\":%.3f,\"dur\":%.3f",
+                start_ns / 1000.0, (event.end_ns - std::max(event.start_ns, registry.start_ns)) / 1000.0);
+
+            ofs << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+            write_json_string(ofs, event.name);
+            ofs << ",\"pid\":1,\"tid\":" << thread->id << ',' << timestamp << '}';
+            first = false;
+            span_count++;
+        }
+        thread->events.clear();
+    }
+    ofs << "\n]}\n";
+
+    if (!ofs)
+        return std::unexpected("Failed to write trace to " + path.string() + ".");
+    return span_count;
+}
+
+size_t get_trace_span_count() {
+    auto& registry = get_trace_registry();
+    std::lock_guard lock(registry.mutex);
+
+    size_t span_count = 0;
+    for (const auto& thread : registry.threads) {
+        std::lock_guard thread_lock(thread->mutex);
+        span_count += thread->events.size();
+    }
+    return span_count;
+}
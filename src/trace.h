@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <string>
+
+// Scoped spans written out as a Chrome trace, which chrome://tracing and Perfetto open.
+// Build with ZOE_TRACING=0 to compile every span out. Otherwise an idle span costs one relaxed
+// atomic load, and a recorded one two clock reads and an append to a per-thread buffer.
+#ifndef ZOE_TRACING
+#define ZOE_TRACING 1
+#endif
+
+inline std::atomic<bool> trace_recording = false;
+
+inline uint64_t get_trace_time_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// name must outlive the recording, which string literals do.
+void record_trace_span(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+// Names the calling thread in traces.
+void set_trace_thread_name(const char* name);
+
+// Drops any previous recording and starts a new one.
+void start_trace();
+// Stops recording and writes the spans as Chrome trace JSON.
+std::expected<size_t, std::string> stop_trace(const std::filesystem::path& path);
+// Spans recorded so far.
+size_t get_trace_span_count();
+
+class trace_span_t {
+public:
+    explicit trace_span_t(const char* span_name)
+        : name(trace_recording.load(std::memory_order_relaxed) ? span_name : nullptr),
+          start_ns(name ? get_trace_time_ns() : 0) {}
+
+    ~trace_span_t() {
+        if (name)
+            record_trace_span(name, start_ns, get_trace_time_ns());
+    }
+
+    trace_span_t(const trace_span_t&) = delete;
+    trace_span_t& operator=(const trace_span_t&) = delete;
+
+private:
+    const char* name;
+    uint64_t start_ns;
+};
+
+#if ZOE_TRACING
+#define ZOE_TRACE_CONCAT_INNER(a, b) a##b
+#define ZOE_TRACE_CONCAT(a, b) ZOE_TRACE_CONCAT_INNER(a, b)
+// Records a span from here to the end of the enclosing scope.
+#define TRACE_SCOPE(name) const trace_span_t ZOE_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
@@ -0,0 +1,202 @@
+#include "voxel_grid.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+// Cells are split between this many hash tables by the top bits of their hash, so they can
+// be averaged in parallel. Fixed rather than per thread so the output order doesn't depend
+// on the pool.
+constexpr int shard_bits = 6;
+constexpr size_t shard_count = size_t(1) << shard_bits;
+// Cell coordinates are packed into a key 21 bits per axis, 2 million cells across.
+constexpr int cell_bits = 21;
+constexpr float cell_bias = static_cast<float>(1 << (cell_bits - 1));
+constexpr uint64_t empty_key = ~uint64_t(0);
+
+uint64_t get_cell_key(const glm::vec3& position, float inv_cell_size) {
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        // Clamped while still a float, as converting one out of range is undefined.
+        const float cell = std::clamp(std::floor(position[axis] * inv_cell_size) + cell_bias, 0.f, 2.f * cell_bias - 1.f);
+        key |= static_cast<uint64_t>(cell) << (axis * cell_bits);
+    }
+    return key;
+}
+
+// The MurmurHash3 finalizer, so neighbouring cells land far apart.
+uint64_t hash_cell_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+struct cell_t {
+    glm::vec3 position_sum;
+    glm::vec3 color_sum;
+    uint32_t count;
+};
+
+struct table_slot_t {
+    uint64_t key;
+    uint32_t cell;
+};
+
+void add_point(cell_t& cell, const vertex_t& vertex) {
+    cell.position_sum += vertex.position;
+    cell.color_sum += vertex.color;
+    cell.count++;
+}
+
+// Packed points are averaged in their quantized units.
+void add_point(cell_t& cell, const packed_vertex_t& vertex) {
+    cell.position_sum += glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]);
+    cell.color_sum += glm::vec3(vertex.color[0], vertex.color[1], vertex.color[2]);
+    cell.count++;
+}
+
+void get_average(const cell_t& cell, vertex_t& out) {
+    const float inv_count = 1.f / static_cast<float>(cell.count);
+    out.position = cell.position_sum * inv_count;
+    out.color = cell.color_sum * inv_count;
+}
+
+void get_average(const cell_t& cell, packed_vertex_t& out) {
+    const float inv_count = 1.f / static_cast<float>(cell.count);
+    const auto position = cell.position_sum * inv_count;
+    const auto color = cell.color_sum * inv_count;
+    out = packed_vertex_t {
+        .position = {
+            static_cast<uint16_t>(position.x + .5f),
+            static_cast<uint16_t>(position.y + .5f),
+            static_cast<uint16_t>(position.z + .5f),
+            0
+        },
+        .color = {
+            static_cast<uint8_t>(color.x + .5f),
+            static_cast<uint8_t>(color.y + .5f),
+            static_cast<uint8_t>(color.z + .5f),
+            255
+        }
+    };
+}
+
+template <typename Vertex, typename GetPosition>
+std::vector<Vertex> downsample(
+    const std::vector<Vertex>& vertices,
+    float cell_size,
+    GetPosition&& get_position,
+    thread_pool_t& pool
+) {
+    TRACE_SCOPE("voxel grid downsample");
+
+    const size_t count = vertices.size();
+    if (count == 0 || !(cell_size > 0.f))
+        return vertices;
+
+    const size_t band_count = std::min<size_t>(count, pool.thread_count() * 4);
+    const size_t band_size = (count + band_count - 1) / band_count;
+    const float inv_cell_size = 1.f / cell_size;
+
+    // Every point's cell, and how many points each band sends to each shard.
+    std::vector<uint64_t> keys(count);
+    std::vector<size_t> band_offsets(band_count * shard_count, 0);
+    pool.parallel_for(band_count, [&](size_t band) {
+        size_t* shard_counts = band_offsets.data() + band * shard_count;
+        const size_t end = std::min(count, (band + 1) * band_size);
+        for (size_t i = band * band_size; i < end; i++) {
+            keys[i] = get_cell_key(get_position(vertices[i]), inv_cell_size);
+            shard_counts[hash_cell_key(keys[i]) >> (64 - shard_bits)]++;
+        }
+    });
+
+    // Counts into where each band's points start within its shard, with the shards one after
+    // another, so every shard sees its points in their original order.
+    std::vector<size_t> shard_offsets(shard_count + 1, 0);
+    for (size_t shard = 0, total = 0; shard < shard_count; shard++) {
+        shard_offsets[shard] = total;
+        for (size_t band = 0; band < band_count; band++) {
+            const size_t band_points = band_offsets[band * shard_count + shard];
+            band_offsets[band * shard_count + shard] = total;
+            total += band_points;
+        }
+        shard_offsets[shard + 1] = total;
+    }
+
+    std::vector<uint32_t> shard_points(count);
+    pool.parallel_for(band_count, [&](size_t band) {
+        size_t* offsets = band_offsets.data() + band * shard_count;
+        const size_t end = std::min(count, (band + 1) * band_size);
+        for (size_t i = band * band_size; i < end; i++)
+            shard_points[offsets[hash_cell_key(keys[i]) >> (64 - shard_bits)]++] = static_cast<uint32_t>(i);
+    });
+
+    // Each shard sums its points into cells through a linear probing table at most half full.
+    std::vector<std::vector<cell_t>> shard_cells(shard_count);
+    pool.parallel_for(shard_count, [&](size_t shard) {
+        const size_t first = shard_offsets[shard];
+        const size_t points = shard_offsets[shard + 1] - first;
+        if (points == 0)
+            return;
+
+        const size_t capacity = std::bit_ceil(points * 2);
+        const size_t mask = capacity - 1;
+        std::vector<table_slot_t> table(capacity, table_slot_t { empty_key, 0 });
+        auto& cells = shard_cells[shard];
+        cells.reserve(points);
+
+        for (size_t i = first; i < first + points; i++) {
+            const uint32_t index = shard_points[i];
+            const uint64_t key = keys[index];
+            size_t slot = hash_cell_key(key) & mask;
+            while (table[slot].key != key && table[slot].key != empty_key)
+                slot = (slot + 1) & mask;
+
+            if (table[slot].key == empty_key) {
+                table[slot] = table_slot_t { key, static_cast<uint32_t>(cells.size()) };
+                cells.push_back(cell_t { glm::vec3(0.f), glm::vec3(0.f), 0 });
+            }
+            add_point(cells[table[slot].cell], vertices[index]);
+        }
+    });
+
+    std::vector<size_t> cell_offsets(shard_count + 1, 0);
+    for (size_t shard = 0; shard < shard_count; shard++)
+        cell_offsets[shard + 1] = cell_offsets[shard] + shard_cells[shard].size();
+
+    std::vector<Vertex> out(cell_offsets.back());
+    pool.parallel_for(shard_count, [&](size_t shard) {
+        const auto& cells = shard_cells[shard];
+        for (size_t cell = 0; cell < cells.size(); cell++)
+            get_average(cells[cell], out[cell_offsets[shard] + cell]);
+    });
+
+    return out;
+}
+
+}
+
+std::vector<vertex_t> downsample_voxel_grid(const std::vector<vertex_t>& vertices, float cell_size, thread_pool_t& pool) {
+    return downsample(vertices, cell_size, [](const vertex_t& vertex) { return vertex.position; }, pool);
+}
+
+std::vector<packed_vertex_t> downsample_voxel_grid(
+    const std::vector<packed_vertex_t>& vertices,
+    const glm::vec3& position_offset,
+    const glm::vec3& position_extent,
+    float cell_size,
+    thread_pool_t& pool
+) {
+    const auto scale = position_extent / 65535.f;
+    return downsample(vertices, cell_size, [&](const packed_vertex_t& vertex) {
+        return position_offset + glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) * scale;
+    }, pool);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "depth_cloud.h"
+
+class thread_pool_t;
+
+// Replaces the points in every occupied cell of a grid of cell_size cubes with one point at
+// their average position and color. Unlike a pixel stride, which thins near surfaces far
+// more than distant ones, this gives the same density everywhere, and at most one point per
+// cell. Runs in linear time: cells are found through open addressing hash tables sized
+// up front, so nothing is allocated per point. The output order only depends on the input.
+std::vector<vertex_t> downsample_voxel_grid(const std::vector<vertex_t>& vertices, float cell_size, thread_pool_t& pool);
+// Packed positions are dequantized with the same offset and extent the shader uses, and the
+// averages quantized again within the same bounds.
+std::vector<packed_vertex_t> downsample_voxel_grid(
+    const std::vector<packed_vertex_t>& vertices,
+    const glm::vec3& position_offset,
+    const glm::vec3& position_extent,
+    float cell_size,
+    thread_pool_t& pool
+);
@@ -0,0 +1,131 @@
+// Stands in for a live ZoeDepth process by replaying image and depth map files into the
+// viewer's ingest socket, so the path can be tested offline. Built from the files in src/
+// apart from main.cpp.
+//
+// Usage: frame_replay [--fps N] [--loop] [--focal-length F] [--sequence IMAGE_PATTERN DEPTH_PATTERN FIRST]
+//                     SOCKET [IMAGE DEPTH]...
+//
+// Frames are decoded on a pool a few ahead of the one being sent, and sent at the given rate,
+// or as fast as the viewer takes them with --fps 0. The principal point is the image center.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "depth_cloud.h"
+#include "frame_ingest.h"
+#include "frame_pattern.h"
+#include "thread_pool.h"
+
+using replay_clock_t = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    double fps = 30.0;
+    bool loop = false;
+    float focal_length = 1400.f;
+    std::string socket_path;
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> pairs;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--fps" && i + 1 < argc)
+            fps = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--loop")
+            loop = true;
+        else if (arg == "--focal-length" && i + 1 < argc)
+            focal_length = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--sequence" && i + 3 < argc) {
+            const int first_frame = std::max(0, std::atoi(argv[i + 3]));
+            const auto count = count_sequence_frames(argv[i + 1], argv[i + 2], first_frame);
+            if (!count) {
+                std::fprintf(stderr, "%s\n", count.error().c_str());
+                return EXIT_FAILURE;
+            }
+            for (int frame = first_frame; frame < first_frame + *count; frame++)
+                pairs.emplace_back(*format_frame_path(argv[i + 1], frame), *format_frame_path(argv[i + 2], frame));
+            i += 3;
+        }
+        else if (arg.starts_with("--"))
+            usage = true;
+        else if (socket_path.empty())
+            socket_path = arg;
+        else if (i + 1 < argc) {
+            pairs.emplace_back(argv[i], argv[i + 1]);
+            i++;
+        }
+        else
+            usage = true;
+    }
+
+    if (usage || socket_path.empty() || pairs.empty()) {
+        std::fprintf(stderr, "Usage: %s [--fps N] [--loop] [--focal-length F] [--sequence IMAGE_PATTERN DEPTH_PATTERN FIRST] SOCKET [IMAGE DEPTH]...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto sender = frame_sender_t::connect(socket_path);
+    if (!sender) {
+        std::fprintf(stderr, "%s\n", sender.error().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Decoding ahead on the pool keeps the send rate independent of the decoders, while only
+    // a few frames are held at once however long the sequence.
+    thread_pool_t pool(thread_pool_t::default_thread_count());
+    const size_t look_ahead = pool.thread_count() + 1;
+    using decoded_t = std::expected<depth_images_t, std::string>;
+    std::deque<std::future<decoded_t>> decoding;
+    size_t next_pair = 0;
+    const auto decode_ahead = [&]() {
+        while (decoding.size() < look_ahead && (loop || next_pair < pairs.size())) {
+            const auto& [image_path, depth_path] = pairs[next_pair++ % pairs.size()];
+            const auto task = std::make_shared<std::packaged_task<decoded_t()>>([&pool, image_path, depth_path]() {
+                return load_depth_images(image_path, depth_path, &pool);
+            });
+            decoding.push_back(task->get_future());
+            pool.submit([task]() { (*task)(); });
+        }
+    };
+
+    decode_ahead();
+    // Paced from the first frame being ready rather than from the first decode starting.
+    decoding.front().wait();
+
+    const auto interval = fps > 0.0 ? std::chrono::duration<double>(1.0 / fps) : std::chrono::duration<double>(0.0);
+    const auto start = replay_clock_t::now();
+    size_t sent = 0;
+    double sent_bytes = 0.0;
+
+    while (!decoding.empty()) {
+        const auto frame = decoding.front().get();
+        decoding.pop_front();
+        decode_ahead();
+        if (!frame) {
+            std::fprintf(stderr, "%s\n", frame.error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<replay_clock_t::duration>(interval * sent));
+
+        const auto cx = (*frame).width * .5f;
+        const auto cy = (*frame).height * .5f;
+        if (auto result = (*sender).send(*frame, focal_length, focal_length, cx, cy); !result) {
+            std::fprintf(stderr, "%s\n", result.error().c_str());
+            return EXIT_FAILURE;
+        }
+
+        sent++;
+        sent_bytes += sizeof(ingest_frame_header_t)
+            + static_cast<double>((*frame).width) * (*frame).height * (3 + ((*frame).metric_depth.data ? sizeof(float) : sizeof(uint16_t)));
+    }
+
+    const double seconds = std::chrono::duration<double>(replay_clock_t::now() - start).count();
+    std::printf("Sent %zu frames in %.2f s, %.1f fps, %.1f MB/s\n", sent, seconds, sent / seconds, sent_bytes / (1 << 20) / seconds);
+    return EXIT_SUCCESS;
+}